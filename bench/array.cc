@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+
+#include "reaction/react.h"
+
+// 4096个元素的数组:calc里手写循环(每次分配新结果)对比expr的SIMD内核(复用结果缓冲区)
+namespace {
+  constexpr std::size_t kSize = 4096;
+  constexpr int kRounds = 2000;
+
+  template <typename F>
+  double measure(F&& update) {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; ++round) {
+      update(round);
+    }
+    std::chrono::duration<double, std::micro> cost = std::chrono::steady_clock::now() - start;
+    return cost.count() / kRounds;
+  }
+}  // namespace
+
+int main() {
+  using Vec = reaction::Array<double>;
+  Vec init(kSize, 1.5);
+  auto a = reaction::var(init);
+  auto b = reaction::var(init);
+  double sink = 0;
+
+  auto run = [&](auto& node) {
+    return measure([&](int round) {
+      init[0] = round;
+      a.value(init);
+      sink += node.get()[0];
+    });
+  };
+  auto report = [](const char* name, double handWritten, double fused) {
+    std::cout << name << " hand-written calc " << handWritten << " us/update, simd expr " << fused
+              << " us/update, speedup x" << handWritten / fused << std::endl;
+  };
+
+  // 单个运算
+  {
+    double handWritten = 0;
+    double fused = 0;
+    {
+      auto node = reaction::calc(
+          [](const Vec& x, const Vec& y) {
+            Vec out(x.size());
+            for (std::size_t i = 0; i < x.size(); ++i) {
+              out[i] = x[i] * y[i];
+            }
+            return out;
+          },
+          a, b);
+      handWritten = run(node);
+    }
+    {
+      auto node = reaction::expr(a * b);
+      fused = run(node);
+    }
+    report("a * b                ", handWritten, fused);
+  }
+  // 嵌套的表达式树
+  {
+    double handWritten = 0;
+    double fused = 0;
+    {
+      auto node = reaction::calc(
+          [](const Vec& x, const Vec& y) {
+            Vec out(x.size());
+            for (std::size_t i = 0; i < x.size(); ++i) {
+              out[i] = (x[i] + y[i]) * x[i] - y[i] / 3.0;
+            }
+            return out;
+          },
+          a, b);
+      handWritten = run(node);
+    }
+    {
+      auto node = reaction::expr((a + b) * a - b / 3.0);
+      fused = run(node);
+    }
+    report("(a + b) * a - b / 3.0", handWritten, fused);
+  }
+  return sink == 0;
+}
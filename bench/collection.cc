@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "reaction/react.h"
+
+// 10万档的订单簿每次改一档:calc整体重建排序和过滤,对比增量集合只处理变化的那一档
+namespace {
+  constexpr int kLevels = 100000;
+  constexpr int kRounds = 200;
+
+  template <typename F>
+  double measure(F&& update) {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; ++round) {
+      update(round);
+    }
+    std::chrono::duration<double, std::micro> cost = std::chrono::steady_clock::now() - start;
+    return cost.count() / kRounds;
+  }
+}  // namespace
+
+int main() {
+  std::map<int, int> levels;
+  for (int i = 0; i < kLevels; ++i) {
+    levels.emplace(i, (i * 7919) % 1000);
+  }
+
+  std::size_t sink = 0;
+  double rebuild = 0;
+  double incremental = 0;
+  {
+    auto book = reaction::var(levels);
+    auto byQty = reaction::calc(
+        [](const std::map<int, int>& book) {
+          std::vector<std::pair<int, int>> out(book.begin(), book.end());
+          std::sort(out.begin(), out.end(),
+                    [](const auto& l, const auto& r) { return l.second < r.second; });
+          return out;
+        },
+        book);
+    auto large = reaction::calc(
+        [](const std::map<int, int>& book) {
+          std::map<int, int> out;
+          for (const auto& [price, qty] : book) {
+            if (qty >= 500) {
+              out.emplace(price, qty);
+            }
+          }
+          return out;
+        },
+        book);
+    auto current = levels;
+    rebuild = measure([&](int round) {
+      current[round * 37 % kLevels] = round;
+      book.value(current);
+      sink += byQty.get().size() + large.get().size();
+    });
+  }
+  {
+    auto book = reaction::reactiveMap(levels);
+    auto byQty = reaction::sorted(book);
+    auto large = reaction::filtered(book, [](int qty) { return qty >= 500; });
+    incremental = measure([&](int round) {
+      book->set(round * 37 % kLevels, round);
+      sink += byQty.get().size() + large.get().size();
+    });
+  }
+
+  std::cout << "calc rebuild   " << rebuild << " us/update" << std::endl;
+  std::cout << "incremental    " << incremental << " us/update  speedup x" << rebuild / incremental
+            << std::endl;
+  return sink == 0;  // 防止结果被优化掉
+}
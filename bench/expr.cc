@@ -0,0 +1,51 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+#include "reaction/react.h"
+
+// 同一棵表达式树:expr()直接内联计算,对比旧的做法——把树包进std::function、每次计算用()收集依赖
+namespace {
+  constexpr int kRounds = 200000;
+
+  template <typename F>
+  double measure(F&& update) {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; ++round) {
+      update(round);
+    }
+    std::chrono::duration<double, std::nano> cost = std::chrono::steady_clock::now() - start;
+    return cost.count() / kRounds;
+  }
+}  // namespace
+
+int main() {
+  auto a = reaction::var(1.0);
+  auto b = reaction::var(2.0);
+  auto c = reaction::var(3.0);
+  auto d = reaction::var(4.0);
+  auto tree = (a * b + c) * (a - d) / (b + 1.5) - c * d;
+
+  double sink = 0;
+  double erased = 0;
+  double fused = 0;
+  {
+    std::function<double()> fun = [tree]() { return tree(); };  // calc按具体类型保存,这里显式擦除
+    auto node = reaction::calc(fun);
+    erased = measure([&](int round) {
+      a.value(static_cast<double>(round));
+      sink += node.get();
+    });
+  }
+  {
+    auto node = reaction::expr(tree);
+    fused = measure([&](int round) {
+      a.value(static_cast<double>(round));
+      sink += node.get();
+    });
+  }
+
+  std::cout << "std::function  " << erased << " ns/update" << std::endl;
+  std::cout << "fused expr     " << fused << " ns/update  speedup x" << erased / fused << std::endl;
+  return sink == 0;  // 防止结果被优化掉
+}
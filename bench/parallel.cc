@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "reaction/react.h"
+#include "reaction/threadPool.h"
+
+// 一个数据源扇出到大量互相独立的calc节点,比较1到N个线程并行传播的耗时
+namespace {
+  constexpr std::size_t kNodes = 4096;
+  constexpr int kWork = 500;
+  constexpr int kRounds = 20;
+
+  double heavy(double x) {
+    double acc = 0;
+    for (int i = 0; i < kWork; ++i) {
+      acc += std::sin(x + i) * std::cos(x - i);
+    }
+    return acc;
+  }
+
+  double runRounds(reaction::React<reaction::ReactImpl<double>>& src) {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; ++round) {
+      src.value(static_cast<double>(round));
+    }
+    std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+    return cost.count() / kRounds;
+  }
+}  // namespace
+
+int main() {
+  auto src = reaction::var(0.0);
+  std::vector<decltype(reaction::calc(&heavy, src))> nodes;
+  nodes.reserve(kNodes);
+  for (std::size_t i = 0; i < kNodes; ++i) {
+    nodes.push_back(reaction::calc(&heavy, src));
+  }
+
+  auto& scheduler = reaction::Graph::instance().scheduler();
+  double serial = runRounds(src);
+  std::cout << "threads=serial  " << serial << " ms/wave" << std::endl;
+
+  std::size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t threads = 1; threads <= maxThreads; threads *= 2) {
+    reaction::ThreadPool pool(threads);
+    scheduler.enableParallel(pool);
+    double cost = runRounds(src);
+    scheduler.disableParallel();
+    std::cout << "threads=" << threads << "  " << cost << " ms/wave  speedup x" << serial / cost
+              << std::endl;
+  }
+}
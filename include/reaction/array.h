@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace reaction {
+  // 响应式数组的值类型:在expr里参与+ - * /和比较时逐元素计算,
+  // double数组走SIMD内核,结果写进节点里复用的缓冲区
+  template <typename T>
+  class Array {
+   public:
+    using value_type = T;
+
+    Array() = default;
+    explicit Array(std::size_t size, const T& value = T{}) : m_data(size, value) {}
+    Array(std::initializer_list<T> values) : m_data(values) {}
+    explicit Array(std::vector<T> values) : m_data(std::move(values)) {}
+
+    std::size_t size() const { return m_data.size(); }
+    bool empty() const { return m_data.empty(); }
+    void resize(std::size_t size) { m_data.resize(size); }  // 大小不变时不重新分配
+
+    T* data() { return m_data.data(); }
+    const T* data() const { return m_data.data(); }
+    T& operator[](std::size_t i) { return m_data[i]; }
+    const T& operator[](std::size_t i) const { return m_data[i]; }
+
+    auto begin() { return m_data.begin(); }
+    auto end() { return m_data.end(); }
+    auto begin() const { return m_data.begin(); }
+    auto end() const { return m_data.end(); }
+
+    const std::vector<T>& vector() const { return m_data; }
+
+    // 整体相等,供ChangeTrig使用;逐元素比较请在expr里用==
+    bool operator==(const Array& other) const { return m_data == other.m_data; }
+
+   private:
+    std::vector<T> m_data;
+  };
+
+  template <typename T>
+  struct IsArray : std::false_type {};
+
+  template <typename T>
+  struct IsArray<Array<T>> : std::true_type {};
+
+  template <typename T>
+  struct ElementOf {
+    using type = T;
+  };
+
+  template <typename T>
+  struct ElementOf<Array<T>> {
+    using type = T;
+  };
+}  // namespace reaction
@@ -0,0 +1,1195 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "reaction/expression.h"
+#include "reaction/observerNode.h"
+
+namespace reaction {
+  // 增量集合:数据源每次修改都记下插入、删除、更新的变化,
+  // 下游的mapped/filtered/sorted/groupBy/join/aggregate节点只处理变化的元素,不再整体重算
+  enum class DeltaOp : std::uint8_t { Insert, Erase, Update };
+
+  // 按位置的变化:Insert在index处插入value,Erase删除index处的old,Update把old换成value
+  template <typename T>
+  struct ListDelta {
+    using value_type = T;
+    DeltaOp op;
+    std::size_t index;
+    T value{};
+    T old{};
+  };
+
+  // 按键的变化,字段含义同ListDelta
+  template <typename K, typename V>
+  struct MapDelta {
+    using key_type = K;
+    using value_type = V;
+    DeltaOp op;
+    K key;
+    V value{};
+    V old{};
+  };
+
+  template <typename D>
+  struct IsListDelta : std::false_type {};
+  template <typename T>
+  struct IsListDelta<ListDelta<T>> : std::true_type {};
+
+  // 增量节点的描述类型,作为ReactImpl的模板参数选出对应的Expression特化
+  template <typename T>
+  struct ListSource {};
+  template <typename K, typename V>
+  struct MapSource {};
+  template <typename Source, typename F>
+  struct Mapped {};
+  template <typename Source, typename F>
+  struct Filtered {};
+  template <typename Source, typename Cmp>
+  struct Sorted {};
+  template <typename Source, typename F>
+  struct Grouped {};
+  template <typename Left, typename Right, typename FL, typename FR>
+  struct Joined {};
+  template <typename Source, typename F, typename Agg>
+  struct Aggregated {};
+
+  // 分组聚合的聚合函数,fun从元素里取出参与聚合的值
+  template <typename F = std::identity>
+  struct Sum {
+    F fun{};
+  };
+  struct Count {};
+  template <typename F = std::identity>
+  struct Min {
+    F fun{};
+  };
+  template <typename F = std::identity>
+  struct Max {
+    F fun{};
+  };
+
+  // 带变化日志的集合节点。日志按序号编号,每个下游记一个游标,计算时读取游标之后的变化;
+  // 所有下游都读过的变化在本节点下一次修改前丢弃
+  template <typename Container, typename Delta>
+  class Collection : public Resource<Container> {
+   public:
+    using DeltaType = Delta;
+
+    Collection() : Resource<Container>(Container{}) {}
+    template <typename T>
+    explicit Collection(T&& t) : Resource<Container>(std::forward<T>(t)) {}
+
+    // 只读:绕过日志直接改容器,下游就看不到这次变化
+    const Container& getValue() const { return Resource<Container>::getValue(); }
+
+    // 登记下游的游标,返回当前日志的末尾
+    std::uint64_t attach(const std::uint64_t* cursor) {
+      m_cursors.push_back(cursor);
+      return logEnd();
+    }
+    void detach(const std::uint64_t* cursor) {
+      auto it = std::find(m_cursors.begin(), m_cursors.end(), cursor);
+      if (it != m_cursors.end()) {
+        *it = m_cursors.back();
+        m_cursors.pop_back();
+      }
+    }
+
+    // 依次处理cursor之后的变化,并把cursor移到日志末尾
+    template <typename F>
+    void consume(std::uint64_t& cursor, F&& fun) const {
+      for (std::uint64_t seq = cursor; seq < logEnd(); ++seq) {
+        fun(m_log[static_cast<std::size_t>(seq - m_begin)]);
+      }
+      cursor = logEnd();
+    }
+
+    // 把当前内容当作一串Insert交给fun,新建的下游用它建立初始状态
+    template <typename F>
+    void replay(F&& fun) const {
+      const Container& values = this->getValue();
+      if constexpr (IsListDelta<Delta>::value) {
+        for (std::size_t i = 0; i < values.size(); ++i) {
+          fun(Delta{DeltaOp::Insert, i, values[i]});
+        }
+      } else if constexpr (std::is_same_v<typename Container::mapped_type,
+                                          typename Delta::value_type>) {
+        for (const auto& [key, value] : values) {
+          fun(Delta{DeltaOp::Insert, key, value});
+        }
+      } else {
+        for (const auto& [group, entries] : values) {  // 分组后的集合,键是(组,原键)
+          for (const auto& [key, value] : entries) {
+            fun(Delta{DeltaOp::Insert, {group, key}, value});
+          }
+        }
+      }
+    }
+
+    std::uint64_t logEnd() const { return m_begin + m_log.size(); }
+    std::size_t logSize() const { return m_log.size(); }
+
+   protected:
+    Container& values() { return Resource<Container>::getValue(); }
+
+    // 修改或计算前调用:丢弃所有下游都已经读过的变化
+    void compact() {
+      std::uint64_t done = logEnd();
+      for (const auto* cursor : m_cursors) {
+        done = std::min(done, *cursor);
+      }
+      if (done == logEnd()) {
+        m_log.clear();
+      } else if (done > m_begin) {
+        m_log.erase(m_log.begin(), m_log.begin() + static_cast<std::ptrdiff_t>(done - m_begin));
+      }
+      m_begin = done;
+    }
+
+    void emit(Delta delta) { m_log.push_back(std::move(delta)); }
+
+    // 数据源的修改入口:fun返回是否产生了变化,有变化才通知下游;
+    // 并发写入模式下与ReactImpl::value一样按分量加锁或推迟
+    template <typename F>
+    void commit(F&& fun) {
+      ObserverGraph* graph = this->graph();
+      if (!graph->concurrent()) {
+        apply(fun);
+        return;
+      }
+      if (graph->mustDefer(this)) {
+        graph->defer([self = NodeRef<Collection>(this), fun = std::forward<F>(fun)]() mutable {
+          self->commit(std::move(fun));
+        });
+        return;
+      }
+      graph->exclusive(this, [&] { apply(fun); });
+    }
+
+   private:
+    template <typename F>
+    void apply(F& fun) {
+      compact();
+      if (fun()) {
+        this->notify();
+      }
+    }
+
+    std::vector<Delta> m_log;
+    std::uint64_t m_begin = 0;                   // m_log[0]的序号
+    std::vector<const std::uint64_t*> m_cursors;  // 下游节点里的游标
+  };
+
+  // 消费其他集合节点变化的派生节点:订阅数据源,用数据源的当前内容初始化,
+  // 之后每次计算只处理各个游标之后的变化。单个数据源时Derived提供apply(const Delta&),
+  // 多个数据源时提供apply(Input<I>, const Delta&),按数据源的顺序依次处理
+  template <std::size_t I>
+  using Input = std::integral_constant<std::size_t, I>;
+
+  template <typename Derived, typename Container, typename Delta, typename... Sources>
+  class DeltaView : public Collection<Container, Delta> {
+   public:
+    using ExprType = CalcExpressionTag;
+    using ValueType = Container;
+
+    explicit DeltaView(const NodeRef<Sources>&... sources) : m_sources(sources...) {}
+    ~DeltaView() override {
+      eachSource([this](auto i) { std::get<i>(m_sources)->detach(&m_cursors[i]); });
+    }
+
+    void pull() {}  // 总是及时计算
+
+   protected:
+    void bindSources() {
+      this->resetSources(std::apply(
+          [](const auto&... sources) { return std::vector<ObserverNode*>{sources.get()...}; },
+          m_sources));
+      eachSource([this](auto i) {
+        auto& source = std::get<i>(m_sources);
+        m_cursors[i] = source->attach(&m_cursors[i]);
+        source->replay([this, i](const auto& delta) { dispatch(i, delta); });
+      });
+    }
+
+   private:
+    template <typename F>
+    static void eachSource(F&& fun) {
+      [&]<std::size_t... I>(std::index_sequence<I...>) {
+        (fun(Input<I>{}), ...);
+      }(std::index_sequence_for<Sources...>{});
+    }
+
+    template <std::size_t I, typename D>
+    void dispatch(Input<I> input, const D& delta) {
+      if constexpr (sizeof...(Sources) == 1) {
+        static_cast<Derived&>(*this).apply(delta);
+      } else {
+        static_cast<Derived&>(*this).apply(input, delta);
+      }
+    }
+
+    bool valueChanged() override {
+      this->compact();
+      std::uint64_t end = this->logEnd();
+      eachSource([this](auto i) {
+        std::get<i>(m_sources)->consume(m_cursors[i],
+                                        [this, i](const auto& delta) { dispatch(i, delta); });
+      });
+      return this->logEnd() != end;
+    }
+
+    std::tuple<NodeRef<Sources>...> m_sources;
+    std::array<std::uint64_t, sizeof...(Sources)> m_cursors{};
+  };
+
+  // 按位置的数据源:->访问到的是节点本身,只读接口之外的修改都会记成变化
+  template <typename T>
+  class Expression<ListSource<T>> : public Collection<std::vector<T>, ListDelta<T>> {
+   public:
+    using ExprType = VarExpressionTag;
+    using ValueType = std::vector<T>;
+    using Collection<std::vector<T>, ListDelta<T>>::Collection;
+
+    Expression* getRawPtr() { return this; }
+
+    std::size_t size() const { return this->getValue().size(); }
+    bool empty() const { return this->getValue().empty(); }
+    const T& operator[](std::size_t index) const { return this->getValue()[index]; }
+    auto begin() const { return this->getValue().begin(); }
+    auto end() const { return this->getValue().end(); }
+
+    void push_back(T value) { insert(size(), std::move(value)); }
+
+    void insert(std::size_t index, T value) {
+      check(index, size() + 1);
+      this->commit([this, index, value = std::move(value)]() {
+        auto& list = this->values();
+        list.insert(list.begin() + static_cast<std::ptrdiff_t>(index), value);
+        this->emit({DeltaOp::Insert, index, value});
+        return true;
+      });
+    }
+
+    void erase(std::size_t index) {
+      check(index, size());
+      this->commit([this, index]() {
+        auto& list = this->values();
+        this->emit({DeltaOp::Erase, index, {}, std::move(list[index])});
+        list.erase(list.begin() + static_cast<std::ptrdiff_t>(index));
+        return true;
+      });
+    }
+
+    void set(std::size_t index, T value) {
+      check(index, size());
+      this->commit([this, index, value = std::move(value)]() {
+        auto& slot = this->values()[index];
+        if constexpr (std::equality_comparable<T>) {
+          if (slot == value) {
+            return false;
+          }
+        }
+        this->emit({DeltaOp::Update, index, value, std::exchange(slot, value)});
+        return true;
+      });
+    }
+
+    // value()整体替换:重叠部分逐个比较,多出的部分插入或删除
+    template <typename C>
+    bool updateValue(C&& values) {
+      this->compact();
+      const std::vector<T>& next = values;
+      auto& list = this->values();
+      std::uint64_t end = this->logEnd();
+      std::size_t common = std::min(list.size(), next.size());
+      for (std::size_t i = 0; i < common; ++i) {
+        if constexpr (std::equality_comparable<T>) {
+          if (list[i] == next[i]) {
+            continue;
+          }
+        }
+        this->emit({DeltaOp::Update, i, next[i], std::exchange(list[i], next[i])});
+      }
+      while (list.size() > next.size()) {
+        this->emit({DeltaOp::Erase, list.size() - 1, {}, std::move(list.back())});
+        list.pop_back();
+      }
+      for (std::size_t i = list.size(); i < next.size(); ++i) {
+        list.push_back(next[i]);
+        this->emit({DeltaOp::Insert, i, next[i]});
+      }
+      return this->logEnd() != end;
+    }
+
+   private:
+    static void check(std::size_t index, std::size_t limit) {
+      if (index >= limit) {
+        throw std::out_of_range("Reactive vector index out of range");
+      }
+    }
+  };
+
+  // 按键的数据源,键有序,与std::map一致
+  template <typename K, typename V>
+  class Expression<MapSource<K, V>> : public Collection<std::map<K, V>, MapDelta<K, V>> {
+   public:
+    using ExprType = VarExpressionTag;
+    using ValueType = std::map<K, V>;
+    using Collection<std::map<K, V>, MapDelta<K, V>>::Collection;
+
+    Expression* getRawPtr() { return this; }
+
+    std::size_t size() const { return this->getValue().size(); }
+    bool empty() const { return this->getValue().empty(); }
+    bool contains(const K& key) const { return this->getValue().contains(key); }
+    const V& at(const K& key) const { return this->getValue().at(key); }
+    auto begin() const { return this->getValue().begin(); }
+    auto end() const { return this->getValue().end(); }
+
+    // 没有这个键时插入,否则更新
+    void set(K key, V value) {
+      this->commit([this, key = std::move(key), value = std::move(value)]() {
+        return assign(key, value);
+      });
+    }
+
+    void erase(K key) {
+      this->commit([this, key = std::move(key)]() {
+        auto& map = this->values();
+        auto it = map.find(key);
+        if (it == map.end()) {
+          return false;
+        }
+        this->emit({DeltaOp::Erase, key, {}, std::move(it->second)});
+        map.erase(it);
+        return true;
+      });
+    }
+
+    // value()整体替换:两个有序表归并一遍,只记下真正不同的键
+    template <typename C>
+    bool updateValue(C&& values) {
+      this->compact();
+      const std::map<K, V>& next = values;
+      auto& map = this->values();
+      std::uint64_t end = this->logEnd();
+      for (auto it = map.begin(); it != map.end();) {
+        if (next.contains(it->first)) {
+          ++it;
+        } else {
+          this->emit({DeltaOp::Erase, it->first, {}, std::move(it->second)});
+          it = map.erase(it);
+        }
+      }
+      for (const auto& [key, value] : next) {
+        assign(key, value);
+      }
+      return this->logEnd() != end;
+    }
+
+   private:
+    bool assign(const K& key, const V& value) {
+      auto [it, inserted] = this->values().try_emplace(key, value);
+      if (inserted) {
+        this->emit({DeltaOp::Insert, key, value});
+        return true;
+      }
+      if constexpr (std::equality_comparable<V>) {
+        if (it->second == value) {
+          return false;
+        }
+      }
+      this->emit({DeltaOp::Update, key, value, std::exchange(it->second, value)});
+      return true;
+    }
+  };
+
+  template <typename Delta, typename F>
+  struct MappedTraits {
+    using Value = std::decay_t<std::invoke_result_t<const F&, const typename Delta::value_type&>>;
+    using Container = std::vector<Value>;
+    using DeltaType = ListDelta<Value>;
+  };
+  template <typename K, typename V, typename F>
+  struct MappedTraits<MapDelta<K, V>, F> {
+    using Value = std::decay_t<std::invoke_result_t<const F&, const V&>>;
+    using Container = std::map<K, Value>;
+    using DeltaType = MapDelta<K, Value>;
+  };
+
+  // 逐元素变换:只对变化的元素调用fun,位置或键与数据源一一对应
+  template <typename Source, typename F>
+  class Expression<Mapped<Source, F>>
+      : public DeltaView<Expression<Mapped<Source, F>>,
+                         typename MappedTraits<typename Source::DeltaType, F>::Container,
+                         typename MappedTraits<typename Source::DeltaType, F>::DeltaType, Source> {
+    using Traits = MappedTraits<typename Source::DeltaType, F>;
+    using Base = DeltaView<Expression, typename Traits::Container, typename Traits::DeltaType, Source>;
+    friend Base;
+
+   public:
+    template <typename T>
+    Expression(const NodeRef<Source>& source, T&& fun) : Base(source), m_fun(std::forward<T>(fun)) {}
+
+   private:
+    void apply(const typename Source::DeltaType& delta) {
+      auto& out = this->values();
+      if constexpr (IsListDelta<typename Source::DeltaType>::value) {
+        auto pos = out.begin() + static_cast<std::ptrdiff_t>(delta.index);
+        switch (delta.op) {
+          case DeltaOp::Insert:
+            this->emit({DeltaOp::Insert, delta.index, *out.insert(pos, std::invoke(m_fun, delta.value))});
+            break;
+          case DeltaOp::Erase:
+            this->emit({DeltaOp::Erase, delta.index, {}, std::move(*pos)});
+            out.erase(pos);
+            break;
+          case DeltaOp::Update: {
+            auto old = std::exchange(*pos, std::invoke(m_fun, delta.value));
+            this->emit({DeltaOp::Update, delta.index, *pos, std::move(old)});
+            break;
+          }
+        }
+      } else {
+        switch (delta.op) {
+          case DeltaOp::Insert: {
+            auto it = out.try_emplace(delta.key, std::invoke(m_fun, delta.value)).first;
+            this->emit({DeltaOp::Insert, delta.key, it->second});
+            break;
+          }
+          case DeltaOp::Erase: {
+            auto it = out.find(delta.key);
+            this->emit({DeltaOp::Erase, delta.key, {}, std::move(it->second)});
+            out.erase(it);
+            break;
+          }
+          case DeltaOp::Update: {
+            auto& slot = out.at(delta.key);
+            auto old = std::exchange(slot, std::invoke(m_fun, delta.value));
+            this->emit({DeltaOp::Update, delta.key, slot, std::move(old)});
+            break;
+          }
+        }
+      }
+    }
+
+    F m_fun;
+  };
+
+  // 按位置过滤时的名次统计:按位置排列的隐式treap,每个结点记录子树的元素个数和其中保留的个数,
+  // 数据源第i个元素在结果里的位置是前i个里保留的个数;插入、删除、修改和查询都是O(log n)
+  class RankIndex {
+   public:
+    bool kept(std::size_t index) const {
+      std::uint32_t node = m_root;
+      for (;;) {
+        const Node& n = m_nodes[node];
+        std::size_t left = sizeOf(n.left);
+        if (index == left) {
+          return n.self;
+        }
+        if (index < left) {
+          node = n.left;
+        } else {
+          index -= left + 1;
+          node = n.right;
+        }
+      }
+    }
+
+    // [0, index)中保留的个数
+    std::size_t rank(std::size_t index) const {
+      std::size_t count = 0;
+      for (std::uint32_t node = m_root; node != kNil;) {
+        const Node& n = m_nodes[node];
+        std::size_t left = sizeOf(n.left);
+        if (index <= left) {
+          node = n.left;
+        } else {
+          count += keptOf(n.left) + n.self;
+          index -= left + 1;
+          node = n.right;
+        }
+      }
+      return count;
+    }
+
+    void insert(std::size_t index, bool kept) {
+      auto [left, right] = split(m_root, index);
+      m_root = merge(merge(left, make(kept)), right);
+    }
+
+    void erase(std::size_t index) {
+      auto [left, rest] = split(m_root, index);
+      auto [node, right] = split(rest, 1);
+      m_free.push_back(node);
+      m_root = merge(left, right);
+    }
+
+    void set(std::size_t index, bool kept) {
+      if (this->kept(index) == kept) {
+        return;
+      }
+      std::uint32_t node = m_root;
+      for (;;) {
+        Node& n = m_nodes[node];
+        n.keptCount = kept ? n.keptCount + 1 : n.keptCount - 1;
+        std::size_t left = sizeOf(n.left);
+        if (index == left) {
+          n.self = kept;
+          return;
+        }
+        if (index < left) {
+          node = n.left;
+        } else {
+          index -= left + 1;
+          node = n.right;
+        }
+      }
+    }
+
+   private:
+    static constexpr std::uint32_t kNil = UINT32_MAX;
+
+    struct Node {
+      std::uint32_t left = kNil;
+      std::uint32_t right = kNil;
+      std::uint32_t priority = 0;
+      bool self = false;
+      std::size_t size = 1;
+      std::size_t keptCount = 0;
+    };
+
+    std::size_t sizeOf(std::uint32_t node) const { return node == kNil ? 0 : m_nodes[node].size; }
+    std::size_t keptOf(std::uint32_t node) const { return node == kNil ? 0 : m_nodes[node].keptCount; }
+
+    void pullUp(std::uint32_t node) {
+      Node& n = m_nodes[node];
+      n.size = sizeOf(n.left) + sizeOf(n.right) + 1;
+      n.keptCount = keptOf(n.left) + keptOf(n.right) + n.self;
+    }
+
+    std::uint32_t make(bool kept) {
+      m_seed ^= m_seed << 13;  // xorshift,只用来打散优先级
+      m_seed ^= m_seed >> 17;
+      m_seed ^= m_seed << 5;
+      Node node{kNil, kNil, m_seed, kept, 1, kept ? 1u : 0u};
+      if (!m_free.empty()) {
+        std::uint32_t index = m_free.back();
+        m_free.pop_back();
+        m_nodes[index] = node;
+        return index;
+      }
+      m_nodes.push_back(node);
+      return static_cast<std::uint32_t>(m_nodes.size() - 1);
+    }
+
+    // 前count个元素分到左边
+    std::pair<std::uint32_t, std::uint32_t> split(std::uint32_t node, std::size_t count) {
+      if (node == kNil) {
+        return {kNil, kNil};
+      }
+      std::size_t left = sizeOf(m_nodes[node].left);
+      if (count <= left) {
+        auto [l, r] = split(m_nodes[node].left, count);
+        m_nodes[node].left = r;
+        pullUp(node);
+        return {l, node};
+      }
+      auto [l, r] = split(m_nodes[node].right, count - left - 1);
+      m_nodes[node].right = l;
+      pullUp(node);
+      return {node, r};
+    }
+
+    std::uint32_t merge(std::uint32_t a, std::uint32_t b) {
+      if (a == kNil || b == kNil) {
+        return a == kNil ? b : a;
+      }
+      if (m_nodes[a].priority > m_nodes[b].priority) {
+        m_nodes[a].right = merge(m_nodes[a].right, b);
+        pullUp(a);
+        return a;
+      }
+      m_nodes[b].left = merge(a, m_nodes[b].left);
+      pullUp(b);
+      return b;
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<std::uint32_t> m_free;
+    std::uint32_t m_root = kNil;
+    std::uint32_t m_seed = 2463534242u;
+  };
+
+  template <typename Delta>
+  struct FilteredTraits {
+    using Container = std::vector<typename Delta::value_type>;
+  };
+  template <typename K, typename V>
+  struct FilteredTraits<MapDelta<K, V>> {
+    using Container = std::map<K, V>;
+  };
+
+  // 过滤:只对变化的元素调用谓词,按键和按位置的集合定位每个变化都是O(log n)
+  template <typename Source, typename F>
+  class Expression<Filtered<Source, F>>
+      : public DeltaView<Expression<Filtered<Source, F>>,
+                         typename FilteredTraits<typename Source::DeltaType>::Container,
+                         typename Source::DeltaType, Source> {
+    using Delta = typename Source::DeltaType;
+    using Base = DeltaView<Expression, typename FilteredTraits<Delta>::Container, Delta, Source>;
+    friend Base;
+
+   public:
+    template <typename T>
+    Expression(const NodeRef<Source>& source, T&& pred) : Base(source), m_pred(std::forward<T>(pred)) {}
+
+   private:
+    bool keep(const typename Delta::value_type& value) const {
+      return static_cast<bool>(std::invoke(m_pred, value));
+    }
+
+    void apply(const Delta& delta) {
+      if constexpr (IsListDelta<Delta>::value) {
+        applyList(delta);
+      } else {
+        applyMap(delta);
+      }
+    }
+
+    void applyList(const Delta& delta) {
+      auto& out = this->values();
+      std::size_t index = delta.index;
+      std::size_t pos = m_rank.rank(index);
+      auto at = out.begin() + static_cast<std::ptrdiff_t>(pos);
+      switch (delta.op) {
+        case DeltaOp::Insert: {
+          bool kept = keep(delta.value);
+          m_rank.insert(index, kept);
+          if (kept) {
+            out.insert(at, delta.value);
+            this->emit({DeltaOp::Insert, pos, delta.value});
+          }
+          break;
+        }
+        case DeltaOp::Erase:
+          if (m_rank.kept(index)) {
+            this->emit({DeltaOp::Erase, pos, {}, std::move(*at)});
+            out.erase(at);
+          }
+          m_rank.erase(index);
+          break;
+        case DeltaOp::Update: {
+          bool was = m_rank.kept(index);
+          bool kept = keep(delta.value);
+          if (was && kept) {
+            this->emit({DeltaOp::Update, pos, delta.value, std::exchange(*at, delta.value)});
+          } else if (was) {
+            this->emit({DeltaOp::Erase, pos, {}, std::move(*at)});
+            out.erase(at);
+          } else if (kept) {
+            out.insert(at, delta.value);
+            this->emit({DeltaOp::Insert, pos, delta.value});
+          }
+          m_rank.set(index, kept);
+          break;
+        }
+      }
+    }
+
+    void applyMap(const Delta& delta) {
+      auto& out = this->values();
+      auto it = out.find(delta.key);
+      bool was = it != out.end();
+      bool kept = delta.op != DeltaOp::Erase && keep(delta.value);
+      if (was && kept) {
+        this->emit({DeltaOp::Update, delta.key, delta.value, std::exchange(it->second, delta.value)});
+      } else if (was) {
+        this->emit({DeltaOp::Erase, delta.key, {}, std::move(it->second)});
+        out.erase(it);
+      } else if (kept) {
+        out.emplace(delta.key, delta.value);
+        this->emit({DeltaOp::Insert, delta.key, delta.value});
+      }
+    }
+
+    F m_pred;
+    RankIndex m_rank;  // 按位置过滤时每个元素是否保留
+  };
+
+  template <typename Delta>
+  struct SortedTraits {
+    using Element = typename Delta::value_type;
+  };
+  template <typename K, typename V>
+  struct SortedTraits<MapDelta<K, V>> {
+    using Element = std::pair<K, V>;
+  };
+
+  // 排序:结果是按cmp有序的vector,变化的元素二分定位后插入或删除,输出按位置的变化;
+  // 按键的集合按值排序、值相同按键排序,结果元素是(键,值)
+  template <typename Source, typename Cmp>
+  class Expression<Sorted<Source, Cmp>>
+      : public DeltaView<Expression<Sorted<Source, Cmp>>,
+                         std::vector<typename SortedTraits<typename Source::DeltaType>::Element>,
+                         ListDelta<typename SortedTraits<typename Source::DeltaType>::Element>,
+                         Source> {
+    using Delta = typename Source::DeltaType;
+    using Element = typename SortedTraits<Delta>::Element;
+    using Base = DeltaView<Expression, std::vector<Element>, ListDelta<Element>, Source>;
+    friend Base;
+
+   public:
+    template <typename T>
+    Expression(const NodeRef<Source>& source, T&& cmp) : Base(source), m_cmp(std::forward<T>(cmp)) {}
+
+   private:
+    static constexpr bool kKeyed = !IsListDelta<Delta>::value;
+
+    bool before(const Element& l, const Element& r) const {
+      if constexpr (kKeyed) {
+        if (std::invoke(m_cmp, l.second, r.second)) {
+          return true;
+        }
+        return !std::invoke(m_cmp, r.second, l.second) && l.first < r.first;
+      } else {
+        return std::invoke(m_cmp, l, r);
+      }
+    }
+
+    Element element(const Delta& delta, bool old) const {
+      const auto& value = old ? delta.old : delta.value;
+      if constexpr (kKeyed) {
+        return {delta.key, value};
+      } else {
+        return value;
+      }
+    }
+
+    // 按键排序是全序,二分即可定位;按位置的集合在等价区间里再按==找
+    std::size_t locate(const Element& element) const {
+      const auto& out = this->getValue();
+      auto less = [this](const Element& l, const Element& r) { return before(l, r); };
+      auto it = std::lower_bound(out.begin(), out.end(), element, less);
+      if constexpr (!kKeyed) {
+        while (it != out.end() && !(*it == element)) {
+          ++it;
+        }
+      }
+      return static_cast<std::size_t>(it - out.begin());
+    }
+
+    std::size_t position(const Element& element) const {
+      const auto& out = this->getValue();
+      auto less = [this](const Element& l, const Element& r) { return before(l, r); };
+      return static_cast<std::size_t>(std::upper_bound(out.begin(), out.end(), element, less) -
+                                      out.begin());
+    }
+
+    void insert(Element element) {
+      std::size_t pos = position(element);
+      auto& out = this->values();
+      out.insert(out.begin() + static_cast<std::ptrdiff_t>(pos), element);
+      this->emit({DeltaOp::Insert, pos, std::move(element)});
+    }
+
+    void erase(const Element& element) {
+      std::size_t pos = locate(element);
+      auto& out = this->values();
+      this->emit({DeltaOp::Erase, pos, {}, std::move(out[pos])});
+      out.erase(out.begin() + static_cast<std::ptrdiff_t>(pos));
+    }
+
+    void apply(const Delta& delta) {
+      switch (delta.op) {
+        case DeltaOp::Insert:
+          insert(element(delta, false));
+          break;
+        case DeltaOp::Erase:
+          erase(element(delta, true));
+          break;
+        case DeltaOp::Update: {
+          // 新值仍落在原来的位置时记成一次原地更新
+          Element next = element(delta, false);
+          std::size_t pos = locate(element(delta, true));
+          auto& out = this->values();
+          bool stays = (pos == 0 || !before(next, out[pos - 1])) &&
+                       (pos + 1 == out.size() || !before(out[pos + 1], next));
+          if (stays) {
+            this->emit({DeltaOp::Update, pos, next, std::exchange(out[pos], next)});
+          } else {
+            erase(element(delta, true));
+            insert(std::move(next));
+          }
+          break;
+        }
+      }
+    }
+
+    Cmp m_cmp;
+  };
+
+  template <typename Delta, typename F>
+  struct GroupedTraits {
+    using Key = typename Delta::key_type;
+    using Value = typename Delta::value_type;
+    using Group = std::decay_t<std::invoke_result_t<const F&, const Value&>>;
+    using Container = std::map<Group, std::map<Key, Value>>;
+    using DeltaType = MapDelta<std::pair<Group, Key>, Value>;
+  };
+
+  // 分组:按fun(值)把按键的集合分成若干组,结果是组到(键,值)表的映射;
+  // 输出的变化以(组,原键)为键,值改到别的组时记成一次删除加一次插入
+  template <typename Source, typename F>
+  class Expression<Grouped<Source, F>>
+      : public DeltaView<Expression<Grouped<Source, F>>,
+                         typename GroupedTraits<typename Source::DeltaType, F>::Container,
+                         typename GroupedTraits<typename Source::DeltaType, F>::DeltaType, Source> {
+    using Delta = typename Source::DeltaType;
+    using Traits = GroupedTraits<Delta, F>;
+    using Base = DeltaView<Expression, typename Traits::Container, typename Traits::DeltaType, Source>;
+    friend Base;
+
+   public:
+    template <typename T>
+    Expression(const NodeRef<Source>& source, T&& fun) : Base(source), m_fun(std::forward<T>(fun)) {}
+
+   private:
+    using Group = typename Traits::Group;
+
+    void insert(const Group& group, const Delta& delta) {
+      this->values()[group].emplace(delta.key, delta.value);
+      this->emit({DeltaOp::Insert, {group, delta.key}, delta.value});
+    }
+
+    void erase(const Group& group, const Delta& delta) {
+      auto& groups = this->values();
+      auto it = groups.find(group);
+      auto entry = it->second.find(delta.key);
+      this->emit({DeltaOp::Erase, {group, delta.key}, {}, std::move(entry->second)});
+      it->second.erase(entry);
+      if (it->second.empty()) {
+        groups.erase(it);  // 空组随之消失
+      }
+    }
+
+    void apply(const Delta& delta) {
+      switch (delta.op) {
+        case DeltaOp::Insert:
+          insert(std::invoke(m_fun, delta.value), delta);
+          break;
+        case DeltaOp::Erase:
+          erase(std::invoke(m_fun, delta.old), delta);
+          break;
+        case DeltaOp::Update: {
+          Group from = std::invoke(m_fun, delta.old);
+          Group to = std::invoke(m_fun, delta.value);
+          if (from == to) {
+            auto& slot = this->values()[from][delta.key];
+            this->emit({DeltaOp::Update, {from, delta.key}, delta.value, std::exchange(slot, delta.value)});
+          } else {
+            erase(from, delta);
+            insert(to, delta);
+          }
+          break;
+        }
+      }
+    }
+
+    F m_fun;
+  };
+
+  // 连接键函数可以只接收值,也可以接收(键,值),后者用于按另一边的键连接
+  template <typename F, typename K, typename V>
+  decltype(auto) joinKey(const F& fun, const K& key, const V& value) {
+    if constexpr (std::is_invocable_v<const F&, const K&, const V&>) {
+      return std::invoke(fun, key, value);
+    } else {
+      return std::invoke(fun, value);
+    }
+  }
+
+  template <typename Left, typename Right, typename FL, typename FR>
+  struct JoinedTraits {
+    using LeftDelta = typename Left::DeltaType;
+    using RightDelta = typename Right::DeltaType;
+    using LeftKey = typename LeftDelta::key_type;
+    using RightKey = typename RightDelta::key_type;
+    using LeftValue = typename LeftDelta::value_type;
+    using RightValue = typename RightDelta::value_type;
+    using JoinKey = std::decay_t<decltype(joinKey(std::declval<const FL&>(), std::declval<const LeftKey&>(),
+                                                  std::declval<const LeftValue&>()))>;
+    using Key = std::pair<LeftKey, RightKey>;
+    using Value = std::pair<LeftValue, RightValue>;
+    using Container = std::map<Key, Value>;
+    using DeltaType = MapDelta<Key, Value>;
+  };
+
+  // 等值连接:左右两个按键的集合里连接键相等的元素两两配对,结果以(左键,右键)为键。
+  // 两边各按连接键建索引,一个变化只和另一边同一连接键的元素配对,代价与匹配数成正比;
+  // 同一轮两边都变时先用右边的旧索引处理左边的变化,再用左边的新索引处理右边的变化
+  template <typename Left, typename Right, typename FL, typename FR>
+  class Expression<Joined<Left, Right, FL, FR>>
+      : public DeltaView<Expression<Joined<Left, Right, FL, FR>>,
+                         typename JoinedTraits<Left, Right, FL, FR>::Container,
+                         typename JoinedTraits<Left, Right, FL, FR>::DeltaType, Left, Right> {
+    using Traits = JoinedTraits<Left, Right, FL, FR>;
+    using Base = DeltaView<Expression, typename Traits::Container, typename Traits::DeltaType, Left,
+                           Right>;
+    friend Base;
+
+   public:
+    template <typename L, typename R>
+    Expression(const NodeRef<Left>& left, const NodeRef<Right>& right, L&& fl, R&& fr)
+        : Base(left, right), m_fl(std::forward<L>(fl)), m_fr(std::forward<R>(fr)) {}
+
+   private:
+    using JoinKey = typename Traits::JoinKey;
+    using LeftDelta = typename Traits::LeftDelta;
+    using RightDelta = typename Traits::RightDelta;
+    template <typename K, typename V>
+    using Index = std::map<JoinKey, std::map<K, V>>;
+
+    void apply(Input<0>, const LeftDelta& delta) {
+      applySide<true>(delta, m_fl, m_left, m_right);
+    }
+    void apply(Input<1>, const RightDelta& delta) {
+      applySide<false>(delta, m_fr, m_right, m_left);
+    }
+
+    // mine是变化这一边的索引,other是另一边的索引
+    template <bool IsLeft, typename Delta, typename F, typename Mine, typename Other>
+    void applySide(const Delta& delta, const F& fun, Mine& mine, const Other& other) {
+      switch (delta.op) {
+        case DeltaOp::Insert:
+          insert<IsLeft>(joinKey(fun, delta.key, delta.value), delta, mine, other);
+          break;
+        case DeltaOp::Erase:
+          erase<IsLeft>(joinKey(fun, delta.key, delta.old), delta, mine, other);
+          break;
+        case DeltaOp::Update: {
+          JoinKey from = joinKey(fun, delta.key, delta.old);
+          JoinKey to = joinKey(fun, delta.key, delta.value);
+          if (!(from == to)) {
+            erase<IsLeft>(from, delta, mine, other);
+            insert<IsLeft>(to, delta, mine, other);
+            break;
+          }
+          mine[to][delta.key] = delta.value;
+          matches(to, other, [&](const auto& key, const auto& value) {
+            auto pair = pairOf<IsLeft>(delta.key, key);
+            auto next = pairOf<IsLeft>(delta.value, value);
+            auto& slot = this->values().at(pair);
+            this->emit({DeltaOp::Update, std::move(pair), next, std::exchange(slot, next)});
+          });
+          break;
+        }
+      }
+    }
+
+    template <bool IsLeft, typename Delta, typename Mine, typename Other>
+    void insert(const JoinKey& join, const Delta& delta, Mine& mine, const Other& other) {
+      mine[join].emplace(delta.key, delta.value);
+      matches(join, other, [&](const auto& key, const auto& value) {
+        auto entry = pairOf<IsLeft>(delta.value, value);
+        this->values().emplace(pairOf<IsLeft>(delta.key, key), entry);
+        this->emit({DeltaOp::Insert, pairOf<IsLeft>(delta.key, key), std::move(entry)});
+      });
+    }
+
+    template <bool IsLeft, typename Delta, typename Mine, typename Other>
+    void erase(const JoinKey& join, const Delta& delta, Mine& mine, const Other& other) {
+      auto it = mine.find(join);
+      it->second.erase(delta.key);
+      if (it->second.empty()) {
+        mine.erase(it);
+      }
+      matches(join, other, [&](const auto& key, const auto&) {
+        auto entry = this->values().find(pairOf<IsLeft>(delta.key, key));
+        this->emit({DeltaOp::Erase, entry->first, {}, std::move(entry->second)});
+        this->values().erase(entry);
+      });
+    }
+
+    template <typename Other, typename F>
+    static void matches(const JoinKey& join, const Other& other, F&& fun) {
+      auto it = other.find(join);
+      if (it != other.end()) {
+        for (const auto& [key, value] : it->second) {
+          fun(key, value);
+        }
+      }
+    }
+
+    // 结果里左边的在前
+    template <bool IsLeft, typename A, typename B>
+    static auto pairOf(const A& mine, const B& other) {
+      if constexpr (IsLeft) {
+        return std::pair<A, B>(mine, other);
+      } else {
+        return std::pair<B, A>(other, mine);
+      }
+    }
+
+    FL m_fl;
+    FR m_fr;
+    Index<typename Traits::LeftKey, typename Traits::LeftValue> m_left;
+    Index<typename Traits::RightKey, typename Traits::RightValue> m_right;
+  };
+
+  template <typename Delta, typename F, typename Agg>
+  struct AggregatedTraits {
+    using Group = std::decay_t<std::invoke_result_t<const F&, const typename Delta::value_type&>>;
+    using Result = std::decay_t<
+        std::invoke_result_t<const decltype(Agg::fun)&, const typename Delta::value_type&>>;
+  };
+  template <typename Delta, typename F>
+  struct AggregatedTraits<Delta, F, Count> {
+    using Group = std::decay_t<std::invoke_result_t<const F&, const typename Delta::value_type&>>;
+    using Result = std::size_t;
+  };
+
+  template <typename Agg>
+  struct IsExtremum : std::false_type {};
+  template <typename F>
+  struct IsExtremum<Min<F>> : std::true_type {};
+  template <typename F>
+  struct IsExtremum<Max<F>> : std::true_type {};
+
+  template <typename Agg>
+  struct IsMin : std::false_type {};
+  template <typename F>
+  struct IsMin<Min<F>> : std::true_type {};
+
+  // 分组聚合:按fun(值)分组,每组维护Sum/Count/Min/Max的聚合状态,结果是组到聚合值的映射。
+  // 一个变化只改动所在组的状态:Sum和Count是O(1),Min/Max在组内的有序计数表里增删是O(log n);
+  // 组里的元素全部删除后这个组从结果里消失。按位置和按键的集合都可以聚合
+  template <typename Source, typename F, typename Agg>
+  class Expression<Aggregated<Source, F, Agg>>
+      : public DeltaView<
+            Expression<Aggregated<Source, F, Agg>>,
+            std::map<typename AggregatedTraits<typename Source::DeltaType, F, Agg>::Group,
+                     typename AggregatedTraits<typename Source::DeltaType, F, Agg>::Result>,
+            MapDelta<typename AggregatedTraits<typename Source::DeltaType, F, Agg>::Group,
+                     typename AggregatedTraits<typename Source::DeltaType, F, Agg>::Result>,
+            Source> {
+    using Delta = typename Source::DeltaType;
+    using Traits = AggregatedTraits<Delta, F, Agg>;
+    using Group = typename Traits::Group;
+    using Result = typename Traits::Result;
+    using Base = DeltaView<Expression, std::map<Group, Result>, MapDelta<Group, Result>, Source>;
+    friend Base;
+
+   public:
+    template <typename T, typename A>
+    Expression(const NodeRef<Source>& source, T&& fun, A&& agg)
+        : Base(source), m_fun(std::forward<T>(fun)), m_agg(std::forward<A>(agg)) {}
+
+   private:
+    using Value = typename Delta::value_type;
+    using Acc = std::conditional_t<IsExtremum<Agg>::value, std::map<Result, std::size_t>, Result>;
+
+    struct State {
+      std::size_t count = 0;
+      Acc acc{};
+    };
+
+    void add(State& state, const Value& value, bool added) {
+      if (added) {
+        ++state.count;
+      } else {
+        --state.count;
+      }
+      if constexpr (std::is_same_v<Agg, Count>) {
+        state.acc = state.count;
+      } else if constexpr (IsExtremum<Agg>::value) {
+        auto it = state.acc.try_emplace(std::invoke(m_agg.fun, value), 0).first;
+        if (added) {
+          ++it->second;
+        } else if (--it->second == 0) {
+          state.acc.erase(it);
+        }
+      } else if (added) {
+        state.acc += std::invoke(m_agg.fun, value);
+      } else {
+        state.acc -= std::invoke(m_agg.fun, value);
+      }
+    }
+
+    Result result(const State& state) const {
+      if constexpr (IsMin<Agg>::value) {
+        return state.acc.begin()->first;
+      } else if constexpr (IsExtremum<Agg>::value) {
+        return state.acc.rbegin()->first;
+      } else {
+        return state.acc;
+      }
+    }
+
+    // 组内先删掉removed再加入added,然后把这个组新旧两个结果的差别记成变化
+    void change(const Group& group, const Value* removed, const Value* added) {
+      auto state = m_states.try_emplace(group).first;
+      if (removed) {
+        add(state->second, *removed, false);
+      }
+      if (added) {
+        add(state->second, *added, true);
+      }
+      auto& out = this->values();
+      auto it = out.find(group);
+      if (state->second.count == 0) {
+        m_states.erase(state);
+        if (it != out.end()) {
+          this->emit({DeltaOp::Erase, group, {}, std::move(it->second)});
+          out.erase(it);
+        }
+        return;
+      }
+      Result next = result(state->second);
+      if (it == out.end()) {
+        out.emplace(group, next);
+        this->emit({DeltaOp::Insert, group, std::move(next)});
+      } else if (!(it->second == next)) {
+        this->emit({DeltaOp::Update, group, next, std::exchange(it->second, next)});
+      }
+    }
+
+    void apply(const Delta& delta) {
+      switch (delta.op) {
+        case DeltaOp::Insert:
+          change(std::invoke(m_fun, delta.value), nullptr, &delta.value);
+          break;
+        case DeltaOp::Erase:
+          change(std::invoke(m_fun, delta.old), &delta.old, nullptr);
+          break;
+        case DeltaOp::Update: {
+          Group from = std::invoke(m_fun, delta.old);
+          Group to = std::invoke(m_fun, delta.value);
+          if (from == to) {
+            change(to, &delta.old, &delta.value);
+          } else {
+            change(from, &delta.old, nullptr);
+            change(to, nullptr, &delta.value);
+          }
+          break;
+        }
+      }
+    }
+
+    F m_fun;
+    Agg m_agg;
+    std::map<Group, State> m_states;
+  };
+}  // namespace reaction
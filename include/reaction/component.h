@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#include "policy.h"
+
+namespace reaction {
+  // 连通分量的并查集节点:有依赖边相连的节点属于同一个分量,并发写入按分量的根加锁。
+  // 分量只合并不拆分,删边后仍按原分量串行,只是保守一些;
+  // 按秩合并、不做路径压缩,父指针只在持有所有条带锁时改写,未加锁的find也能安全读取
+  class Component {
+   public:
+    Component() { m_refs.increment(); }  // 节点持有一份
+    Component(const Component&) = delete;
+    Component& operator=(const Component&) = delete;
+
+    Component* root() {
+      Component* node = this;
+      while (Component* parent = node->m_parent.load(std::memory_order_acquire)) {
+        node = parent;
+      }
+      return node;
+    }
+
+    // 调用方需持有两个分量的锁
+    static void unite(Component* a, Component* b) {
+      a = a->root();
+      b = b->root();
+      if (a == b) {
+        return;
+      }
+      if (a->m_rank < b->m_rank) {
+        std::swap(a, b);
+      }
+      if (a->m_rank == b->m_rank) {
+        ++a->m_rank;
+      }
+      a->m_refs.increment();  // 子分量持有父分量,根不会先于挂在它下面的分量释放
+      b->m_parent.store(a, std::memory_order_release);
+    }
+
+    void release() {
+      Component* node = this;
+      while (node && node->m_refs.decrement() == 0) {
+        Component* parent = node->m_parent.load(std::memory_order_relaxed);
+        delete node;
+        node = parent;
+      }
+    }
+
+   private:
+    ~Component() = default;
+
+    std::atomic<Component*> m_parent{nullptr};
+    std::uint32_t m_rank = 0;
+    RefCount<> m_refs;
+  };
+}  // namespace reaction
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <concepts>
 #include <memory>
 #include <type_traits>
@@ -11,18 +13,24 @@ namespace reaction {
   template <typename T>
   class React;
 
+  template <typename Op, typename... Args>
+  class OpExpr;
+
   template <typename Op, typename L, typename R>
-  class BinaryOpExpr;
+  using BinaryOpExpr = OpExpr<Op, L, R>;
 
   template <typename T>
   struct ValueWrapper;
 
+  template <typename T>
+  class NodeRef;
+
   struct VarExpressionTag;
   class ObserverNode;
   struct VoidWrapper;
   class FieldBase;
 
-  using NodePtr = std::shared_ptr<ObserverNode>;
+  using NodePtr = NodeRef<ObserverNode>;
 
   //==================================concepts=========================================
   template <typename T, typename U>
@@ -47,9 +55,7 @@ namespace reaction {
   concept HasArgs = sizeof...(Args) > 0;
 
   template <typename T>
-  concept IsReactNode = requires(T t) {
-    { t.shared_from_this() } -> std::same_as<NodePtr>;
-  };
+  concept IsReactNode = std::derived_from<T, ObserverNode>;
 
   template <typename T>
   concept IsDataReact = requires(T t) {
@@ -72,14 +78,15 @@ namespace reaction {
     using type = T;
   };
 
+  // 数据源节点的值类型由节点自己给出,增量集合的描述类型不是值类型
   template <NonInvocableType T>
   struct ExpressionTraits<React<ReactImpl<T>>> {
-    using type = T;
+    using type = typename ReactImpl<T>::ValueType;
   };
 
   template <typename Fun, typename... Args>
   struct ExpressionTraits<React<ReactImpl<Fun, Args...>>> {
-    using rawtype = std::invoke_result_t<Fun, typename ExpressionTraits<Args>::type...>;
+    using rawtype = std::invoke_result_t<Fun, const typename ExpressionTraits<Args>::type&...>;
     using type = std::conditional_t<VoidType<rawtype>, VoidWrapper, rawtype>;
   };
 
@@ -88,19 +95,40 @@ namespace reaction {
       typename ExpressionTraits<React<ReactImpl<Fun, Args...>>>::type;  // 避免typename来避免歧义
 
   template <typename T>
-  struct BinaryOpExprTraits : std::false_type {};
+  struct OpExprTraits : std::false_type {};
 
-  template <typename Op, typename L, typename R>
-  struct BinaryOpExprTraits<BinaryOpExpr<Op, L, R>> : std::true_type {};
+  template <typename Op, typename... Args>
+  struct OpExprTraits<OpExpr<Op, Args...>> : std::true_type {};
+
+  template <typename T>
+  concept IsOpExpr = OpExprTraits<std::decay_t<T>>::value;
 
   template <typename T>
-  concept IsBinaryOpExpr = BinaryOpExprTraits<std::decay_t<T>>::value;
+  struct IsValueWrapper : std::false_type {};
 
   template <typename T>
-  using ExprWrapper =
-      std::conditional_t<IsReact<T>::value || IsBinaryOpExpr<T>, T, ValueWrapper<T>>;
+  struct IsValueWrapper<ValueWrapper<T>> : std::true_type {};
+
+  template <typename T>
+  using ExprWrapper = std::conditional_t<IsReact<T>::value || IsOpExpr<T> || IsValueWrapper<T>::value,
+                                         T, ValueWrapper<T>>;
+
+  // 至少有一个操作数是React或表达式时才重载运算符,纯数值之间的运算不受影响
+  template <typename... T>
+  concept HasExprOperand = ((IsReact<std::decay_t<T>>::value || IsOpExpr<T>) || ...);
 
   template <typename L, typename R>
-  concept HasCustomOp = IsReact<std::decay_t<L>>::value || IsReact<std::decay_t<R>>::value ||
-                        IsBinaryOpExpr<std::decay_t<L>> || IsBinaryOpExpr<std::decay_t<R>>;
+  concept HasCustomOp = HasExprOperand<L, R>;
+
+  // 逻辑运算符:React的explicit operator bool已经让!、&&、||表示句柄是否有效,
+  // 只有操作数里已经有表达式时才构造逻辑表达式
+  template <typename... T>
+  concept HasLogicalOp = (IsOpExpr<T> || ...);
+
+  // 构造时就能求值的操作数:普通数值、ValueWrapper和constVar
+  template <typename T>
+  struct IsConstantOperand : std::bool_constant<!IsReact<T>::value && !OpExprTraits<T>::value> {};
+
+  template <typename T>
+  struct IsConstantOperand<React<ReactImpl<T>>> : std::is_const<T> {};
 }  // namespace reaction
\ No newline at end of file
@@ -1,33 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
 #include <concepts>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <variant>
+#include <vector>
 
+#include "reaction/array.h"
+#include "reaction/function.h"
 #include "reaction/observerNode.h"
+#include "reaction/simd.h"
 #include "resource.h"
 
 namespace reaction {
   struct VarExpressionTag {};
   struct CalcExpressionTag {};
 
-  template <typename Op, typename L, typename R>
-  class BinaryOpExpr {
+  // 运算结果类型:有数组操作数且不是归约时逐元素计算,结果是数组,
+  // 比较、逻辑运算的逐元素结果用1/0掩码表示,元素类型与操作数一致
+  template <typename Op>
+  concept ReductionOp = requires { typename Op::is_reduction; };
+
+  template <typename Op, typename... T>
+  struct OpResult {
+    using type = std::decay_t<std::invoke_result_t<const Op&, const T&...>>;
+  };
+
+  template <typename Op, typename... T>
+    requires(!ReductionOp<Op> && (IsArray<T>::value || ...))
+  struct OpResult<Op, T...> {
+    using Element =
+        std::decay_t<std::invoke_result_t<const Op&, const typename ElementOf<T>::type&...>>;
+    using type = Array<std::conditional_t<std::is_same_v<Element, bool>,
+                                          std::common_type_t<typename ElementOf<T>::type...>,
+                                          Element>>;
+  };
+
+  template <typename Op, typename... T>
+  concept ElementwiseOp = IsArray<typename OpResult<Op, T...>::type>::value && !ReductionOp<Op>;
+
+  // 有SIMD内核的运算
+  template <typename Op>
+  struct SimdKind {};
+
+  // 数组表达式的计算:整棵树逐元素融合成一个循环,中间结果不落地,也不分配临时数组;
+  // 只有一个运算且操作数都是double数组或标量时直接调用SIMD内核
+  inline constexpr std::size_t kBroadcast = SIZE_MAX;  // 标量操作数没有长度
+
+  template <typename E>
+  struct Span {
+    const E* data;
+    E operator[](std::size_t i) const { return data[i]; }
+  };
+
+  template <typename E>
+  struct Broadcast {
+    E value;
+    E operator[](std::size_t) const { return value; }
+  };
+
+  // 子表达式的第i个元素:按子表达式的元素类型返回,掩码是1/0而不是bool
+  template <typename E, typename Op, typename... B>
+  struct FusedBlock {
+    const Op* op;
+    std::tuple<B...> blocks;
+    E operator[](std::size_t i) const {
+      return std::apply([&](const auto&... b) { return static_cast<E>((*op)(b[i]...)); }, blocks);
+    }
+  };
+
+  template <typename E>
+  struct ArrayView {
+    const E* data;
+    std::size_t length;
+    std::size_t size() const { return length; }
+    Span<E> load() const { return {data}; }
+  };
+
+  template <typename S>
+  struct ScalarView {
+    S value;  // 每次计算只求值一次
+    std::size_t size() const { return kBroadcast; }
+    Broadcast<S> load() const { return {value}; }
+  };
+
+  template <typename Expr, typename Views>
+  struct ChildView {
+    const Expr* expr;
+    Views views;
+    std::size_t length;
+    std::size_t size() const { return length; }
+    auto load() const { return expr->loadBlock(views); }
+  };
+
+  template <typename... View>
+  std::size_t commonSize(const View&... views) {
+    std::size_t size = kBroadcast;
+    (
+        [&] {
+          std::size_t s = views.size();
+          if (s == kBroadcast) {
+            return;
+          }
+          if (size != kBroadcast && size != s) {
+            throw std::invalid_argument("Array sizes do not match");
+          }
+          size = s;
+        }(),
+        ...);
+    return size;
+  }
+
+  template <typename B>
+  struct IsDoubleLeaf : std::false_type {};
+  template <>
+  struct IsDoubleLeaf<Span<double>> : std::true_type {};
+  template <>
+  struct IsDoubleLeaf<Broadcast<double>> : std::true_type {};
+
+  inline const double* leafData(const Span<double>& b) { return b.data; }
+  inline const double* leafData(const Broadcast<double>& b) { return &b.value; }
+  inline std::size_t leafStride(const Span<double>&) { return 1; }
+  inline std::size_t leafStride(const Broadcast<double>&) { return 0; }
+
+  template <typename Op, typename E, typename... B>
+  void fillElements(const Op& op, E* dst, std::size_t len, const B&... blocks) {
+    if constexpr (std::is_same_v<E, double> && sizeof...(B) == 2 &&
+                  requires { SimdKind<Op>::kind; } && (IsDoubleLeaf<B>::value && ...)) {
+      auto kernel = [&](const auto& l, const auto& r) {
+        simd::binary(SimdKind<Op>::kind, leafData(l), leafStride(l), leafData(r), leafStride(r),
+                     dst, len);
+      };
+      kernel(blocks...);
+    } else {
+#pragma GCC ivdep
+      for (std::size_t i = 0; i < len; ++i) {
+        dst[i] = static_cast<E>(op(blocks[i]...));
+      }
+    }
+  }
+
+  template <typename Op, typename Out, typename Views>
+  void runElementwise(const Op& op, Out& out, const Views& views) {
+    std::size_t size = std::apply([](const auto&... v) { return commonSize(v...); }, views);
+    out.resize(size);
+    std::apply([&](const auto&... v) { fillElements(op, out.data(), size, v.load()...); }, views);
+  }
+
+  // 操作数的视图:数组引用节点里的值,标量求值一次,数组子表达式融合进父表达式的循环
+  template <typename Op, typename Element, typename T>
+  auto makeView(const T& operand) {
+    if constexpr (requires { T::kElementwise; requires T::kElementwise; }) {
+      auto views = operand.makeViews();
+      std::size_t size = std::apply([](const auto&... v) { return commonSize(v...); }, views);
+      return ChildView<T, decltype(views)>{&operand, std::move(views), size};
+    } else if constexpr (IsArray<T>::value) {
+      return ArrayView<typename T::value_type>{operand.data(), operand.size()};
+    } else if constexpr (requires { operand(); }) {
+      decltype(auto) value = operand();
+      if constexpr (IsArray<std::decay_t<decltype(value)>>::value) {
+        static_assert(std::is_lvalue_reference_v<decltype(value)>, "array operand must be stored");
+        return makeView<Op, Element>(value);
+      } else {
+        return makeView<Op, Element>(static_cast<std::decay_t<decltype(value)>>(value));
+      }
+    } else if constexpr (std::is_arithmetic_v<T> && std::is_same_v<Element, double> &&
+                         requires { SimdKind<Op>::kind; }) {
+      return ScalarView<double>{static_cast<double>(operand)};  // 与数组元素相同类型才能走SIMD
+    } else {
+      return ScalarView<T>{operand};
+    }
+  }
+
+  template <typename Op, typename... V>
+  auto applyOp(const Op& op, const V&... values) {
+    if constexpr (ElementwiseOp<Op, V...>) {
+      using Out = typename OpResult<Op, V...>::type;
+      Out out;
+      auto views = std::make_tuple(makeView<Op, typename Out::value_type>(values)...);
+      runElementwise(op, out, views);
+      return out;
+    } else {
+      return op(values...);
+    }
+  }
+
+  template <typename Op, typename... Args>
+  class OpExpr;
+
+  // 表达式树节点:Op作用在一到三个操作数上,操作数是React、常量ValueWrapper或子表达式
+  template <typename Op, typename... Args>
+  class OpExpr {
    public:
-    using ValueType = typename std::common_type_t<typename L::ValueType, typename R::ValueType>;
+    using ValueType = typename OpResult<Op, typename Args::ValueType...>::type;
+    static constexpr bool kElementwise = ElementwiseOp<Op, typename Args::ValueType...>;
 
-    template <typename Left, typename Right>
-    BinaryOpExpr(Left&& l, Right&& r, Op op = Op{})
-        : m_l(std::forward<Left>(l)), m_r(std::forward<Right>(r)), m_op(op) {}
+    template <typename... A>
+      requires(sizeof...(A) == sizeof...(Args))
+    explicit OpExpr(Op op, A&&... args) : m_args(std::forward<A>(args)...), m_op(op) {}
+
+    // 把操作数逐个转换过来,用于把React叶子换成直接指向节点的NodeOperand
+    template <typename... A>
+    explicit OpExpr(const OpExpr<Op, A...>& other) : m_args(other.m_args), m_op(other.m_op) {}
 
     auto operator()() const { return calculate(); }
 
+    // 数组结果直接写进out,大小不变时不再分配内存
+    void evalInto(ValueType& out) const
+      requires kElementwise
+    {
+      auto views = makeViews();
+      runElementwise(m_op, out, views);
+    }
+
+    auto makeViews() const {
+      using Element = typename ValueType::value_type;
+      return std::apply(
+          [](const auto&... args) { return std::make_tuple(makeView<Op, Element>(args)...); },
+          m_args);
+    }
+
+    // 作为子表达式时不单独计算,而是返回逐元素求值的块,由父表达式的循环驱动
+    template <typename Views>
+    auto loadBlock(const Views& views) const {
+      return std::apply(
+          [this](const auto&... v) {
+            return FusedBlock<typename ValueType::value_type, Op, decltype(v.load())...>{
+                &m_op, {v.load()...}};
+          },
+          views);
+    }
+
+    // 遍历表达式树里所有的数据源节点
+    template <typename F>
+    void forEachSource(F&& fun) const {
+      std::apply([&](const auto&... args) { (visitSource(args, fun), ...); }, m_args);
+    }
+
    private:
-    auto calculate() const { return m_op(m_l(), m_r()); }
+    template <typename, typename...>
+    friend class OpExpr;
+
+    auto calculate() const {
+      if constexpr (kElementwise) {
+        ValueType out;
+        evalInto(out);
+        return out;
+      } else {
+        return std::apply([this](const auto&... args) { return applyOp(m_op, args()...); },
+                          m_args);
+      }
+    }
+
+    template <typename T, typename F>
+    static void visitSource(const T& operand, F& fun) {
+      if constexpr (requires { operand.forEachSource(fun); }) {
+        operand.forEachSource(fun);
+      }
+    }
 
    private:
-    L m_l;
-    R m_r;
+    std::tuple<Args...> m_args;
     [[no_unique_address]] Op m_op;  // 空基类优化 1byte-->0 byte
   };
 
@@ -43,6 +285,131 @@ namespace reaction {
   struct DivOp {
     auto operator()(auto&& a, auto&& b) const { return a / b; }
   };
+  struct ModOp {
+    auto operator()(auto&& a, auto&& b) const {
+      if constexpr (std::is_floating_point_v<std::common_type_t<std::decay_t<decltype(a)>,
+                                                                std::decay_t<decltype(b)>>>) {
+        return std::fmod(a, b);
+      } else {
+        return a % b;
+      }
+    }
+  };
+  struct EqOp {
+    bool operator()(auto&& a, auto&& b) const { return a == b; }
+  };
+  struct NeOp {
+    bool operator()(auto&& a, auto&& b) const { return a != b; }
+  };
+  struct LtOp {
+    bool operator()(auto&& a, auto&& b) const { return a < b; }
+  };
+  struct LeOp {
+    bool operator()(auto&& a, auto&& b) const { return a <= b; }
+  };
+  struct GtOp {
+    bool operator()(auto&& a, auto&& b) const { return a > b; }
+  };
+  struct GeOp {
+    bool operator()(auto&& a, auto&& b) const { return a >= b; }
+  };
+  struct AndOp {
+    bool operator()(auto&& a, auto&& b) const { return a && b; }
+  };
+  struct OrOp {
+    bool operator()(auto&& a, auto&& b) const { return a || b; }
+  };
+  struct MinOp {
+    auto operator()(auto&& a, auto&& b) const {
+      using T = std::common_type_t<std::decay_t<decltype(a)>, std::decay_t<decltype(b)>>;
+      return b < a ? T(b) : T(a);
+    }
+  };
+  struct MaxOp {
+    auto operator()(auto&& a, auto&& b) const {
+      using T = std::common_type_t<std::decay_t<decltype(a)>, std::decay_t<decltype(b)>>;
+      return a < b ? T(b) : T(a);
+    }
+  };
+  struct NegOp {
+    auto operator()(auto&& a) const { return -a; }
+  };
+  struct NotOp {
+    bool operator()(auto&& a) const { return !a; }
+  };
+  struct AbsOp {
+    auto operator()(auto&& a) const {
+      using std::abs;
+      return abs(a);
+    }
+  };
+  struct SqrtOp {
+    auto operator()(auto&& a) const {
+      using std::sqrt;
+      return sqrt(a);
+    }
+  };
+  // 两个分支都会求值,不短路
+  struct SelectOp {
+    auto operator()(auto&& cond, auto&& a, auto&& b) const { return cond ? a : b; }
+  };
+
+  // 数组归约
+  struct SumOp {
+    using is_reduction = void;
+    template <typename T>
+    T operator()(const Array<T>& a) const {
+      if constexpr (std::is_same_v<T, double>) {
+        return simd::sum(a.data(), a.size());
+      } else {
+        return std::accumulate(a.begin(), a.end(), T{});
+      }
+    }
+  };
+  struct MeanOp {
+    using is_reduction = void;
+    template <typename T>
+    double operator()(const Array<T>& a) const {
+      return a.empty() ? 0.0 : static_cast<double>(SumOp{}(a)) / static_cast<double>(a.size());
+    }
+  };
+  struct MinElementOp {
+    using is_reduction = void;
+    template <typename T>
+    T operator()(const Array<T>& a) const {
+      if (a.empty()) {
+        throw std::out_of_range("Empty array has no minimum");
+      }
+      return *std::min_element(a.begin(), a.end());
+    }
+  };
+  struct MaxElementOp {
+    using is_reduction = void;
+    template <typename T>
+    T operator()(const Array<T>& a) const {
+      if (a.empty()) {
+        throw std::out_of_range("Empty array has no maximum");
+      }
+      return *std::max_element(a.begin(), a.end());
+    }
+  };
+
+#define REACTION_SIMD_KIND(Op, K)                     \
+  template <>                                         \
+  struct SimdKind<Op> {                               \
+    static constexpr simd::Kind kind = simd::Kind::K; \
+  };
+  REACTION_SIMD_KIND(AddOp, Add)
+  REACTION_SIMD_KIND(SubOp, Sub)
+  REACTION_SIMD_KIND(MulOp, Mul)
+  REACTION_SIMD_KIND(DivOp, Div)
+  REACTION_SIMD_KIND(LtOp, Lt)
+  REACTION_SIMD_KIND(LeOp, Le)
+  REACTION_SIMD_KIND(GtOp, Gt)
+  REACTION_SIMD_KIND(GeOp, Ge)
+  REACTION_SIMD_KIND(EqOp, Eq)
+  REACTION_SIMD_KIND(NeOp, Ne)
+#undef REACTION_SIMD_KIND
 
   template <typename Type>
   struct ValueWrapper {
@@ -56,34 +423,181 @@ namespace reaction {
     operator Type() const { return m_value; }  // 隐式转换
   };
 
+  // expr节点里的叶子:直接持有数据源节点,读取不经过句柄查找也不登记依赖收集
+  template <typename ReactType>
+  class NodeOperand {
+   public:
+    using ValueType = typename ReactType::ValueType;
+
+    explicit NodeOperand(const React<ReactType>& react) : m_node(react.getSharedPtr()) {}
+
+    decltype(auto) operator()() const { return m_node->get(); }
+
+    template <typename F>
+    void forEachSource(F& fun) const {
+      fun(m_node.get());
+    }
+
+   private:
+    NodeRef<ReactType> m_node;
+  };
+
+  template <typename T>
+  struct BoundOperand {
+    using type = T;
+  };
+  template <typename ReactType>
+  struct BoundOperand<React<ReactType>> {
+    using type = NodeOperand<ReactType>;
+  };
+  template <typename Op, typename... Args>
+  struct BoundOperand<OpExpr<Op, Args...>> {
+    using type = OpExpr<Op, typename BoundOperand<Args>::type...>;
+  };
+
+  template <typename T>
+  decltype(auto) constantValue(const T& operand) {
+    if constexpr (IsReact<T>::value) {
+      return operand.get();  // constVar的值不会再变
+    } else if constexpr (IsValueWrapper<T>::value) {
+      return operand();
+    } else {
+      return operand;
+    }
+  }
+
+  // 操作数全是常量时在构造时直接算出结果,不生成表达式节点
+  template <typename Op, typename... A>
+  auto makeOpExpr(A&&... args) {
+    if constexpr ((IsConstantOperand<std::decay_t<A>>::value && ...)) {
+      auto value = applyOp(Op{}, constantValue(args)...);
+      return ValueWrapper<decltype(value)>(std::move(value));
+    } else {
+      return OpExpr<Op, ExprWrapper<std::decay_t<A>>...>(Op{}, std::forward<A>(args)...);
+    }
+  }
+
   template <typename Op, typename L, typename R>
   auto make_binary_expr(L&& l, R&& r) {
-    return BinaryOpExpr<Op, ExprWrapper<std::decay_t<L>>, ExprWrapper<std::decay_t<R>>>(
-        std::forward<L>(l), std::forward<R>(r));
+    return makeOpExpr<Op>(std::forward<L>(l), std::forward<R>(r));
   }
 
-  template <typename L, typename R>
-    requires(HasCustomOp<L, R>)
-  auto operator+(L&& l, R&& r) {
-    return make_binary_expr<AddOp>(std::forward<L>(l), std::forward<R>(r));
+#define REACTION_BINARY_OPERATOR(op, Op, Concept)                       \
+  template <typename L, typename R>                                     \
+    requires(Concept<L, R>)                                             \
+  auto operator op(L&& l, R&& r) {                                      \
+    return make_binary_expr<Op>(std::forward<L>(l), std::forward<R>(r)); \
+  }
+
+  REACTION_BINARY_OPERATOR(+, AddOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(-, SubOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(*, MulOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(/, DivOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(%, ModOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(==, EqOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(!=, NeOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(<, LtOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(<=, LeOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(>, GtOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(>=, GeOp, HasCustomOp)
+  REACTION_BINARY_OPERATOR(&&, AndOp, HasLogicalOp)
+  REACTION_BINARY_OPERATOR(||, OrOp, HasLogicalOp)
+#undef REACTION_BINARY_OPERATOR
+
+  template <typename T>
+    requires(HasExprOperand<T>)
+  auto operator-(T&& t) {
+    return makeOpExpr<NegOp>(std::forward<T>(t));
   }
+  template <typename T>
+    requires(HasLogicalOp<T>)
+  auto operator!(T&& t) {
+    return makeOpExpr<NotOp>(std::forward<T>(t));
+  }
+
   template <typename L, typename R>
-    requires(HasCustomOp<L, R>)
-  auto operator-(L&& l, R&& r) {
-    return make_binary_expr<SubOp>(std::forward<L>(l), std::forward<R>(r));
+    requires(HasExprOperand<L, R>)
+  auto min(L&& l, R&& r) {
+    return makeOpExpr<MinOp>(std::forward<L>(l), std::forward<R>(r));
   }
   template <typename L, typename R>
-    requires(HasCustomOp<L, R>)
-  auto operator*(L&& l, R&& r) {
-    return make_binary_expr<MulOp>(std::forward<L>(l), std::forward<R>(r));
+    requires(HasExprOperand<L, R>)
+  auto max(L&& l, R&& r) {
+    return makeOpExpr<MaxOp>(std::forward<L>(l), std::forward<R>(r));
+  }
+  template <typename T>
+    requires(HasExprOperand<T>)
+  auto abs(T&& t) {
+    return makeOpExpr<AbsOp>(std::forward<T>(t));
+  }
+  template <typename T>
+    requires(HasExprOperand<T>)
+  auto sqrt(T&& t) {
+    return makeOpExpr<SqrtOp>(std::forward<T>(t));
+  }
+  template <typename T>
+    requires(HasExprOperand<T>)
+  auto sum(T&& t) {
+    return makeOpExpr<SumOp>(std::forward<T>(t));
+  }
+  template <typename T>
+    requires(HasExprOperand<T>)
+  auto mean(T&& t) {
+    return makeOpExpr<MeanOp>(std::forward<T>(t));
+  }
+  template <typename T>
+    requires(HasExprOperand<T>)
+  auto minElement(T&& t) {
+    return makeOpExpr<MinElementOp>(std::forward<T>(t));
+  }
+  template <typename T>
+    requires(HasExprOperand<T>)
+  auto maxElement(T&& t) {
+    return makeOpExpr<MaxElementOp>(std::forward<T>(t));
+  }
+  // 三元选择:cond ? a : b
+  template <typename C, typename A, typename B>
+    requires(HasExprOperand<C, A, B>)
+  auto select(C&& cond, A&& a, B&& b) {
+    return makeOpExpr<SelectOp>(std::forward<C>(cond), std::forward<A>(a), std::forward<B>(b));
   }
 
-  template <typename L, typename R>
-    requires(HasCustomOp<L, R>)
-  auto operator/(L&& l, R&& r) {
-    return make_binary_expr<DivOp>(std::forward<L>(l), std::forward<R>(r));
+  // 数据源的值按const引用传给计算函数:接收const T&的函数不复制,也不能改写上游的值
+  template <typename T>
+  const T& argument(T& value) {
+    return value;
+  }
+  template <typename T>
+  T argument(T&& value) {
+    return std::move(value);  // VoidWrapper这样按值返回的
   }
 
+  // calc的计算函数和它读取的数据源节点,按具体类型保存,计算时直接内联调用
+  template <typename R, typename F, typename... Nodes>
+  class CalcFunctor {
+   public:
+    template <typename T>
+    explicit CalcFunctor(T&& fun, const NodeRef<Nodes>&... nodes)
+        : m_fun(std::forward<T>(fun)), m_nodes(nodes...) {}
+
+    R operator()() {
+      return std::apply(
+          [this](const auto&... nodes) -> R {
+            if constexpr (VoidType<R>) {
+              std::invoke(m_fun, argument(nodes->get())...);
+              return VoidWrapper{};
+            } else {
+              return std::invoke(m_fun, argument(nodes->get())...);
+            }
+          },
+          m_nodes);
+    }
+
+   private:
+    F m_fun;
+    std::tuple<NodeRef<Nodes>...> m_nodes;
+  };
+
   template <typename Fun, typename... Args>
   class Expression : public Resource<ExpressionType<Fun, Args...>> {
    public:
@@ -95,43 +609,88 @@ namespace reaction {
       if constexpr (std::convertible_to<ExpressionType<std::decay_t<F>, std::decay_t<A>...>,
                                         ValueType>) {
         this->updateObservers(args.getSharedPtr()...);  // 订阅args的变化
-        setFunctor(createFun(std::forward<F>(fun), std::forward<A>(args)...));
-        evaluate();
+        m_track = sizeof...(A) == 0;                     // 没有参数时靠()收集依赖
+        this->forgetSources();
+        using Functor = CalcFunctor<ValueType, std::decay_t<F>,
+                                    typename IsReact<std::decay_t<A>>::type...>;
+        if constexpr (std::is_same_v<Functor, Direct>) {
+          m_fun.template emplace<Direct>(std::forward<F>(fun), args.getSharedPtr()...);
+        } else {
+          m_fun.template emplace<ErasedPtr>(  // reset成别的函数类型
+              std::make_unique<Erased>(Functor(std::forward<F>(fun), args.getSharedPtr()...)));
+        }
+        if (m_lazy && sizeof...(A) > 0) {
+          m_stale = true;  // 惰性节点等到get时再算;()形式要靠首次计算收集依赖
+        } else {
+          m_stale = false;
+          evaluate();
+        }
       }
     }
-    // 给()使用
-    void addObCb(NodePtr node) { this->updateObservers(node); }
+    void setLazy() { m_lazy = true; }
 
-   private:
-    template <typename F, typename... A>
-    auto createFun(F&& fun, A&&... args) {
-      return [fun = std::forward<F>(fun), ... args = args.getSharedPtr()]() {
-        if constexpr (VoidType<ValueType>) {
-          std::invoke(fun, args->get()...);
-          return VoidWrapper{};
-        } else {
-          return std::invoke(fun, args->get()...);
+    // 惰性节点在读取时才计算;标脏后数据源版本都没变时沿用旧值
+    void pull() {
+      if (m_stale) {
+        if (this->sourcesChanged()) {
+          evaluate();
         }
-      };
+        m_stale = false;
+      }
     }
 
-    void valueChanged() override {
-      evaluate();
-      this->notify();  // 通知观察者更新
+   private:
+    // 创建节点时的函数类型与节点类型一致,按具体类型保存;reset换成别的类型才走类型擦除
+    using Direct = CalcFunctor<ValueType, Fun, typename IsReact<Args>::type...>;
+    using Erased = InlineFunction<ValueType()>;
+    using ErasedPtr = std::unique_ptr<Erased>;
+
+    ValueType call() {
+      if (auto* direct = std::get_if<Direct>(&m_fun)) {
+        return (*direct)();
+      }
+      return (**std::get_if<ErasedPtr>(&m_fun))();
+    }
+
+    void settle() override { pull(); }
+
+    // 值有变化才通知观察者更新,否则剪掉整棵子树
+    bool valueChanged() override {
+      if (m_lazy) {
+        bool wasStale = m_stale;
+        m_stale = true;  // 只标脏,已经脏了说明下游也早已标过
+        return !wasStale;
+      }
+      if (!this->sourcesChanged()) {
+        return false;  // 重复的通知,输入没有变
+      }
+      return evaluate();
     }
     // 实现观察者的更新策略
-    void evaluate() {
+    bool evaluate() {
+      RegGuard guard(m_track ? this : nullptr);  // 有参数的节点也要屏蔽外层的依赖收集
+      if (m_track) {
+        this->beginTrack();
+      }
+      bool changed = true;
       if constexpr (VoidType<ValueType>) {
-        std::invoke(m_fun);  // 参数均在捕获列表里
+        call();  // 参数均在CalcFunctor里
       } else {
-        this->updateValue(std::invoke(m_fun));
+        changed = this->updateValue(call());
+      }
+      if (m_track) {
+        this->endTrack();  // 只订阅这次真正走到的分支
       }
+      this->recordSources();
+      return changed;
     }
 
-    void setFunctor(const std::function<ValueType()>& fun) { m_fun = fun; }
-
    private:
-    std::function<ValueType()> m_fun;  // 用于reset
+    // 同一时刻只存一种;reset成别的函数类型很少见,类型擦除的版本放在堆上,不占节点的空间
+    std::variant<ErasedPtr, Direct> m_fun;
+    bool m_track = false;               // 每次计算时重新收集()读到的依赖
+    bool m_lazy = false;                // 惰性求值:上游变化只标脏
+    bool m_stale = false;               // 惰性节点的值是否过期
   };
 
   template <NonInvocableType Type>
@@ -142,20 +701,43 @@ namespace reaction {
     using Resource<Type>::Resource;
   };
 
-  template <typename Op, typename L, typename R>
-  class Expression<BinaryOpExpr<Op, L, R>>
-      : public Expression<std::function<
-            typename std::common_type_t<typename L::ValueType, typename R::ValueType>()>> {
+  // expr节点直接保存具体的表达式树类型,计算时整棵树内联展开,不经过std::function;
+  // 依赖在建立时按叶子订阅一次,不再每次计算都用()重新收集
+  template <typename Op, typename... Args>
+  class Expression<OpExpr<Op, Args...>> : public Resource<typename OpExpr<Op, Args...>::ValueType> {
    public:
+    using ExprType = CalcExpressionTag;
+    using ValueType = typename OpExpr<Op, Args...>::ValueType;
+
     template <typename T>
     Expression(T&& t) : m_expr(std::forward<T>(t)) {}
 
+    void pull() {}  // 总是及时计算
+
    protected:
-    void setOpExpr() {
-      this->setSource([this]() { return m_expr(); });
+    void bindSources() {
+      std::vector<ObserverNode*> sources;  // 同一个节点出现在多个叶子上也只订阅一次
+      m_expr.forEachSource([&sources](ObserverNode* source) { sources.push_back(source); });
+      this->resetSources(sources);
+      this->recordSources();
+      this->updateValue(m_expr());
     }
 
    private:
-    BinaryOpExpr<Op, L, R> m_expr;
+    // 数组结果原地写进节点的值,不经过触发策略的比较,总是通知下游
+    bool valueChanged() override {
+      if (!this->sourcesChanged()) {
+        return false;
+      }
+      this->recordSources();
+      if constexpr (std::decay_t<decltype(m_expr)>::kElementwise) {
+        m_expr.evalInto(*this->getRawPtr());
+        return true;
+      } else {
+        return this->updateValue(m_expr());
+      }
+    }
+
+    typename BoundOperand<OpExpr<Op, Args...>>::type m_expr;
   };
 }  // namespace reaction
\ No newline at end of file
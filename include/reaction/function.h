@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace reaction {
+  template <typename Signature, std::size_t Capacity = 64>
+  class InlineFunction;
+
+  // 只能移动的可调用对象:Capacity以内的对象直接放在内部缓冲区里,构造不分配内存;
+  // 更大的对象才放到堆上。calc捕获函数和若干个NodeRef,通常放得下
+  template <typename R, typename... A, std::size_t Capacity>
+  class InlineFunction<R(A...), Capacity> {
+   public:
+    InlineFunction() = default;
+
+    template <typename F>
+      requires(!std::is_same_v<std::decay_t<F>, InlineFunction> &&
+               std::is_invocable_r_v<R, std::decay_t<F>&, A...>)
+    InlineFunction(F&& fun) {
+      using Fun = std::decay_t<F>;
+      if constexpr (kInline<Fun>) {
+        ::new (static_cast<void*>(m_buffer)) Fun(std::forward<F>(fun));
+      } else {
+        ::new (static_cast<void*>(m_buffer)) Fun*(new Fun(std::forward<F>(fun)));
+      }
+      m_ops = &kOps<Fun>;
+    }
+
+    InlineFunction(InlineFunction&& other) noexcept { moveFrom(other); }
+    InlineFunction& operator=(InlineFunction&& other) noexcept {
+      if (this != &other) {
+        reset();
+        moveFrom(other);
+      }
+      return *this;
+    }
+    InlineFunction(const InlineFunction&) = delete;
+    InlineFunction& operator=(const InlineFunction&) = delete;
+    ~InlineFunction() { reset(); }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    R operator()(A... args) { return m_ops->invoke(m_buffer, std::forward<A>(args)...); }
+
+    void reset() {
+      if (m_ops) {
+        m_ops->destroy(m_buffer);
+        m_ops = nullptr;
+      }
+    }
+
+    template <typename F>
+    static constexpr bool kInline = sizeof(F) <= Capacity &&
+                                    alignof(F) <= alignof(std::max_align_t) &&
+                                    std::is_nothrow_move_constructible_v<F>;
+
+   private:
+    struct Ops {
+      R (*invoke)(void*, A&&...);
+      void (*move)(void* dst, void* src) noexcept;  // 移动到dst并析构src
+      void (*destroy)(void*) noexcept;
+    };
+
+    template <typename F>
+    static F& target(void* buffer) {
+      if constexpr (kInline<F>) {
+        return *std::launder(static_cast<F*>(buffer));
+      } else {
+        return **std::launder(static_cast<F**>(buffer));
+      }
+    }
+
+    template <typename F>
+    static constexpr Ops kOps{
+        [](void* buffer, A&&... args) -> R {
+          return std::invoke(target<F>(buffer), std::forward<A>(args)...);
+        },
+        [](void* dst, void* src) noexcept {
+          if constexpr (kInline<F>) {
+            ::new (dst) F(std::move(target<F>(src)));
+            target<F>(src).~F();
+          } else {
+            ::new (dst) F*(&target<F>(src));  // 堆上的对象只转移指针
+          }
+        },
+        [](void* buffer) noexcept {
+          if constexpr (kInline<F>) {
+            target<F>(buffer).~F();
+          } else {
+            delete &target<F>(buffer);
+          }
+        }};
+
+    void moveFrom(InlineFunction& other) noexcept {
+      if (other.m_ops) {
+        other.m_ops->move(m_buffer, other.m_buffer);
+        m_ops = std::exchange(other.m_ops, nullptr);
+      }
+    }
+
+    alignas(std::max_align_t) std::byte m_buffer[Capacity];
+    const Ops* m_ops = nullptr;
+  };
+}  // namespace reaction
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <concepts>
+#include <memory>
+#include <utility>
+
+namespace reaction {
+  // 写时复制的不可变值:拷贝只是引用计数加一,适合放大对象的var。
+  // 下游calc按值接收参数时也不会复制底层数据;修改用mutate(),有别人共享时才先复制一份
+  template <typename T>
+  class Immutable {
+   public:
+    using element_type = T;
+
+    Immutable() : m_ptr(std::make_shared<T>()) {}
+    Immutable(T value) : m_ptr(std::make_shared<T>(std::move(value))) {}
+
+    const T& get() const { return *m_ptr; }
+    const T& operator*() const { return *m_ptr; }
+    const T* operator->() const { return m_ptr.get(); }
+    operator const T&() const { return *m_ptr; }  // 可以直接传给接收const T&的函数
+
+    // 取得可写的引用:只有自己持有时原地修改,否则先复制,不影响共享这份值的其他人
+    T& mutate() {
+      if (m_ptr.use_count() != 1) {
+        m_ptr = std::make_shared<T>(std::as_const(*m_ptr));
+      }
+      return *m_ptr;
+    }
+
+    long useCount() const { return m_ptr.use_count(); }
+
+    // 同一份数据直接相等,不逐字节比较
+    bool operator==(const Immutable& other) const
+      requires std::equality_comparable<T>
+    {
+      return m_ptr == other.m_ptr || *m_ptr == *other.m_ptr;
+    }
+
+   private:
+    std::shared_ptr<T> m_ptr;
+  };
+}  // namespace reaction
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "policy.h"
+
+namespace reaction {
+  // 按大小分级的节点内存池:同一级的块从同一大块内存里连续切出,一起创建的节点在内存里也挨在一起;
+  // 释放的块挂回该级的空闲链表复用,超过最大分级的请求直接走operator new
+  class NodePool : public std::pmr::memory_resource {
+   public:
+    static constexpr std::size_t kAlign = alignof(std::max_align_t);
+    static constexpr std::size_t kClasses = 32;  // 16字节一级,最大512字节
+    static constexpr std::size_t kChunkSize = 64 * 1024;
+
+    NodePool() = default;
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+   private:
+    void* do_allocate(std::size_t size, std::size_t alignment) override {
+      std::size_t index = classIndex(size);
+      if (index >= kClasses || alignment > kAlign) {
+        return ::operator new(size, std::align_val_t{alignment});
+      }
+      std::lock_guard<ThreadingPolicy::Mutex> lock(m_mutex);
+      auto& sizeClass = m_classes[index];
+      if (sizeClass.free) {
+        FreeBlock* block = sizeClass.free;
+        sizeClass.free = block->next;
+        return block;
+      }
+      std::size_t blockSize = (index + 1) * kAlign;
+      if (static_cast<std::size_t>(sizeClass.end - sizeClass.cur) < blockSize) {
+        m_chunks.emplace_back(new std::byte[kChunkSize]);  // new[]保证max_align_t对齐
+        sizeClass.cur = m_chunks.back().get();
+        sizeClass.end = sizeClass.cur + kChunkSize;
+      }
+      void* block = sizeClass.cur;
+      sizeClass.cur += blockSize;
+      return block;
+    }
+
+    void do_deallocate(void* ptr, std::size_t size, std::size_t alignment) override {
+      std::size_t index = classIndex(size);
+      if (index >= kClasses || alignment > kAlign) {
+        ::operator delete(ptr, std::align_val_t{alignment});
+        return;
+      }
+      std::lock_guard<ThreadingPolicy::Mutex> lock(m_mutex);
+      auto& sizeClass = m_classes[index];
+      sizeClass.free = new (ptr) FreeBlock{sizeClass.free};
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+      return this == &other;
+    }
+
+    static std::size_t classIndex(std::size_t size) { return (size + kAlign - 1) / kAlign - 1; }
+
+    struct FreeBlock {
+      FreeBlock* next;
+    };
+    struct SizeClass {
+      FreeBlock* free = nullptr;
+      std::byte* cur = nullptr;
+      std::byte* end = nullptr;
+    };
+    std::array<SizeClass, kClasses> m_classes{};
+    std::vector<std::unique_ptr<std::byte[]>> m_chunks;
+    ThreadingPolicy::Mutex m_mutex;
+  };
+}  // namespace reaction
@@ -1,48 +1,857 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
-#include <unordered_set>
+#include <memory_resource>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "component.h"
 #include "concept.h"
+#include "nodePool.h"
+#include "policy.h"
+#include "slotMap.h"
+#include "threadPool.h"
 namespace reaction {
-  class ObserverNode : public std::enable_shared_from_this<ObserverNode> {
+  class ObserverGraph;
+  class Scheduler;
+
+  // 节点自带侵入式引用计数,不再需要shared_ptr的控制块和enable_shared_from_this
+  class ObserverNode {
    public:
-    virtual ~ObserverNode() = default;
-    virtual void valueChanged() {};
+    ObserverNode() = default;
+    ObserverNode(const ObserverNode&) = delete;
+    ObserverNode& operator=(const ObserverNode&) = delete;
+
+    // 节点销毁时把两个方向的边都断开,数据源不再通知已死的观察者;每条边O(1)。
+    // 本轮传播中已经排队的节点也从调度器里撤下
+    virtual ~ObserverNode();
+    // 上游变化时由调度器调用,返回true表示自身值变了,需要继续通知下游
+    virtual bool valueChanged() { return true; };
+    // 惰性节点过期时立即算出最新值,其他节点什么也不做
+    virtual void settle() {}
+    // 快照模式:把当前值记为epoch的版本;丢弃minEpoch时刻已不可见的旧版本,
+    // 返回是否还留着旧版本,要等读者释放后再回收
+    virtual void publishVersion(std::uint64_t) {}
+    virtual bool trimVersions(std::uint64_t) { return false; }
 
-    void addObserver(ObserverNode* observer) { m_observers.emplace_back(observer); }
-    // 订阅主题
+    // 按calc的参数设置依赖:reset时与旧的依赖集合做diff,退订不再读取的数据源,
+    // 观察者列表不会随着反复reset越积越长
     template <typename... Args>
     void updateObservers(Args&&... args) {
-      (void) (...,
-              args->addObserver(this));  // 弃值表达式&折叠表达式,React的getSharedPtr
+      std::vector<ObserverNode*> sources{args.get()...};  // React的getSharedPtr,重复的由resetSources去重
+      m_dynamic = false;
+      resetSources(sources);
+    }
+
+    // 用新的依赖集合替换旧的:退订不再读取的数据源,订阅新读取的。
+    // 在数据源上打访问标记代替查找,diff和去重每条边都是O(1),sources里可以有重复
+    void resetSources(const std::vector<ObserverNode*>& sources) {
+      std::uint64_t wanted = nextMark();
+      for (auto* source : sources) {
+        source->m_mark = wanted;
+      }
+      std::uint64_t linked = nextMark();
+      for (std::size_t i = m_sources.size(); i > 0; --i) {  // 从后往前删,交换过来的边已经检查过
+        ObserverNode* source = m_sources[i - 1].node;
+        if (source->m_mark == wanted) {
+          source->m_mark = linked;
+        } else {
+          unlink(i - 1);
+        }
+      }
+      for (auto* source : sources) {
+        if (source->m_mark != linked) {
+          source->m_mark = linked;
+          link(source);
+        }
+      }
+    }
+
+    // ()形式的节点每次计算都重新收集依赖,计算结束后与上一次的依赖做diff
+    // 收集期间持有读到的数据源,计算中途被销毁的临时节点不会以悬空指针订阅进来
+    void beginTrack() {
+      m_dynamic = true;
+      releaseTracked();
+      m_trackMark = nextMark();
+    }
+    // 同一次计算里重复读到的只记一次;嵌套计算改写了标记时会多记,由resetSources去重。
+    // 在读取数据源的值之前调用
+    void track(ObserverNode* source);
+    void endTrack() {
+      resetSources(m_tracked);
+      releaseTracked();  // 已经订阅上的由边维持,没订阅上的在这里释放
+    }
+
+    void notify();
+
+    // 版本号:每次向下游宣告自己变了就加一。惰性节点标脏时也加一,表示值可能变了
+    std::uint64_t version() const { return m_version; }
+
+    // 与上次计算时记下的数据源版本比较,都没变说明这次通知是多余的,不必重算
+    bool sourcesChanged() const {
+      if (!m_recorded || m_seen.size() != m_sources.size()) {
+        return true;
+      }
+      for (std::size_t i = 0; i < m_sources.size(); ++i) {
+        if (m_sources[i].node->m_version != m_seen[i]) {
+          return true;
+        }
+      }
+      return false;
+    }
+    void recordSources() {
+      m_seen.resize(m_sources.size());
+      for (std::size_t i = 0; i < m_sources.size(); ++i) {
+        m_seen[i] = m_sources[i].node->m_version;
+      }
+      m_recorded = true;
     }
+    void forgetSources() { m_recorded = false; }  // 换了计算函数,下次必须重算
 
-    void notify() {
-      for (auto& observer : m_observers) {
-        observer->valueChanged();  // 调用观察者的更新策略
+    std::size_t depth() const { return m_depth; }
+    std::size_t observerCount() const { return m_observers.size(); }
+    bool dynamic() const { return m_dynamic; }
+    Handle handle() const { return m_handle; }
+    ObserverGraph* graph() const { return m_graph; }
+
+    void retain() { m_refs.increment(); }
+    void release() {
+      if (m_refs.decrement() == 0) {
+        destroy();
       }
     }
+    void setMemory(std::pmr::memory_resource* memory) { m_memory = memory; }
+
+   protected:
+    // 引用计数归零时调用;从NodePool或Arena分配的节点由最终类型析构自己并归还内存
+    virtual void destroy() { delete this; }
+
+    // 释放版本链之前调用:从图的待回收列表里摘掉自己,读者线程不会再来回收它
+    void forgetVersions();
+
+    std::pmr::memory_resource* m_memory = nullptr;
 
    private:
-    std::vector<ObserverNode*> m_observers;  // 这里为啥用裸指针呢
+    struct Edge {
+      ObserverNode* node;  // 对端节点
+      std::size_t index;   // 这条边在对端列表里的下标
+    };
+
+    // 全局递增的访问标记,每次收集或diff取一个新值,不会与旧标记混淆
+    static std::uint64_t nextMark() {
+      static std::atomic<std::uint64_t> marks{0};
+      return marks.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    void releaseTracked() {
+      auto tracked = std::move(m_tracked);
+      m_tracked.clear();
+      for (auto* source : tracked) {
+        source->release();
+      }
+    }
+
+    // 一条依赖边在两端各存一份,各自记着对端那一份的下标
+    void link(ObserverNode* source);
+
+    // 调试构建下检查一条边两端的记录互相指向对方
+    bool agrees(const Edge& edge, const std::vector<Edge> ObserverNode::*back) const {
+      const auto& other = edge.node->*back;
+      return edge.index < other.size() && other[edge.index].node == this;
+    }
+
+    void unlink(std::size_t index) {
+      assert(agrees(m_sources[index], &ObserverNode::m_observers));
+      m_sources[index].node->dropObserver(m_sources[index].index);
+      dropSource(index);
+    }
+
+    // 删除一端的记录:末尾的边换到空出的位置,再改写它对端记着的下标。
+    // 删的就是末尾时不能改写:unlink里对端那份已经先删掉,那个下标上现在是别人的边
+    void dropObserver(std::size_t index) {
+      assert(index < m_observers.size());
+      if (index + 1 != m_observers.size()) {
+        const Edge& moved = m_observers.back();
+        assert(agrees(moved, &ObserverNode::m_sources));
+        moved.node->m_sources[moved.index].index = index;
+        m_observers[index] = moved;
+      }
+      m_observers.pop_back();
+    }
+
+    void dropSource(std::size_t index) {
+      assert(index < m_sources.size());
+      if (index + 1 != m_sources.size()) {
+        const Edge& moved = m_sources.back();
+        assert(agrees(moved, &ObserverNode::m_observers));
+        moved.node->m_observers[moved.index].index = index;
+        m_sources[index] = moved;
+      }
+      m_sources.pop_back();
+      m_recorded = false;  // 数据源的顺序变了,记下的版本对不上
+    }
+
+    void raiseDepth(std::size_t depth) {
+      if (depth <= m_depth) {
+        return;
+      }
+      m_depth = depth;
+      for (const auto& edge : m_observers) {
+        edge.node->raiseDepth(m_depth + 1);  // reset后可能变高,下游跟着抬高
+      }
+    }
+
+    friend class Scheduler;
+    friend class ObserverGraph;
+
+    // 边只在节点之间记裸指针,节点销毁时两端都会断开,不会留下悬空的观察者
+    std::vector<Edge> m_observers;
+    std::vector<Edge> m_sources;             // 已订阅的数据源,用于去重
+    std::vector<ObserverNode*> m_tracked;    // 本次计算中()读到的数据源
+    std::uint64_t m_trackMark = 0;           // 本次计算的访问标记
+    std::uint64_t m_mark = 0;                // 作为数据源被最近一次收集或diff打上的标记
+    std::vector<std::uint64_t> m_seen;       // 上次计算时m_sources各自的版本
+    std::uint64_t m_version = 0;
+    bool m_recorded = false;                 // m_seen是否有效
+    bool m_dynamic = false;                  // 依赖是否由()在计算时动态收集
+    std::size_t m_depth = 0;                 // 拓扑高度,数据源为0
+    bool m_dirty = false;                    // 是否在本轮传播的队列里或正等着计算
+    bool m_unpublished = false;              // 快照模式下本轮变化了、还没发布新版本
+    bool m_retained = false;                 // 快照模式下版本链上还有等着回收的旧版本
+    Handle m_handle;                         // 在ObserverGraph槽位表里的位置
+    ObserverGraph* m_graph = nullptr;        // 所属的图
+    Scheduler* m_scheduler = nullptr;        // 最近一次把它入队或记下变化的调度器
+    Component* m_component = nullptr;        // 并发写入模式下所在的连通分量
+    RefCount<> m_refs;                       // 持有者个数:图、区域、依赖它的calc
+  };
+
+  // 侵入式智能指针,拷贝只是一次计数加一,单线程策略下连原子操作都没有
+  template <typename T>
+  class NodeRef {
+   public:
+    NodeRef() = default;
+    NodeRef(std::nullptr_t) {}
+    explicit NodeRef(T* ptr) : m_ptr(ptr) {
+      if (m_ptr) {
+        m_ptr->retain();
+      }
+    }
+    NodeRef(const NodeRef& other) : NodeRef(other.m_ptr) {}
+    NodeRef(NodeRef&& other) noexcept : m_ptr(std::exchange(other.m_ptr, nullptr)) {}
+    template <typename U>
+      requires std::convertible_to<U*, T*>
+    NodeRef(const NodeRef<U>& other) : NodeRef(other.get()) {}
+    ~NodeRef() { reset(); }
+
+    NodeRef& operator=(NodeRef other) noexcept {
+      std::swap(m_ptr, other.m_ptr);
+      return *this;
+    }
+
+    void reset() {
+      if (auto* ptr = std::exchange(m_ptr, nullptr)) {
+        ptr->release();
+      }
+    }
+
+    T* get() const { return m_ptr; }
+    T& operator*() const { return *m_ptr; }
+    T* operator->() const { return m_ptr; }
+    explicit operator bool() const { return m_ptr != nullptr; }
+
+   private:
+    T* m_ptr = nullptr;
+  };
+
+  // 按拓扑高度从小到大排空脏节点,一轮传播中每个节点最多计算一次,避免菱形依赖的glitch
+  class Scheduler {
+   public:
+    void schedule(ObserverNode* node) {
+      if (node->m_dirty) {
+        return;  // 已在队列中,同一轮只算一次
+      }
+      node->m_dirty = true;
+      node->m_scheduler = this;
+      m_queue.push_back({node->depth(), node});  // 入队时记下高度,计算中高度变化也不破坏堆
+      std::push_heap(m_queue.begin(), m_queue.end(), DepthGreater{});
+    }
+
+    // 节点在排队、等着计算或等着发布时被销毁:把它留下的位置置空,传播时跳过
+    void cancel(ObserverNode* node) {
+      if (node->m_dirty) {
+        for (auto& entry : m_queue) {
+          if (entry.node == node) {
+            entry.node = nullptr;
+          }
+        }
+        std::replace(m_level.begin(), m_level.end(), node, static_cast<ObserverNode*>(nullptr));
+      }
+      if (node->m_unpublished) {
+        std::erase(m_published, node);
+      }
+    }
+
+    void scheduleObservers(ObserverNode* node) {
+      for (const auto& edge : node->m_observers) {
+        schedule(edge.node);
+      }
+    }
+
+    // 快照模式下记录本轮值变化了的节点,最外层传播结束时一起发布成一个新的epoch
+    void recordChange(ObserverNode* node);
+
+    void run() {
+      if (m_running || m_batchDepth > 0) {
+        return;  // 传播或批量更新过程中的notify只负责入队,由最外层统一排空
+      }
+      m_running = true;
+      struct Reset {
+        Scheduler& self;
+        ~Reset() {
+          for (const auto& entry : self.m_queue) {  // 计算抛异常时丢弃剩余的脏节点
+            if (entry.node) {
+              entry.node->m_dirty = false;
+            }
+          }
+          for (auto* node : self.m_level) {
+            if (node) {
+              node->m_dirty = false;
+            }
+          }
+          self.m_queue.clear();
+          self.m_level.clear();
+          self.m_running = false;
+        }
+      } reset{*this};
+
+      while (!m_queue.empty()) {
+        // 取出同一高度的一整层,层内节点互不依赖;节点算完才清m_dirty,
+        // 等着计算时被销毁的节点能在m_level里找到并置空
+        std::size_t depth = m_queue.front().depth;
+        m_level.clear();
+        while (!m_queue.empty() && m_queue.front().depth == depth) {
+          std::pop_heap(m_queue.begin(), m_queue.end(), DepthGreater{});
+          if (auto* node = m_queue.back().node) {
+            m_level.push_back(node);
+          }
+          m_queue.pop_back();
+        }
+
+        if (m_pool && m_level.size() >= m_minParallelLevel) {
+          for (auto* node : m_level) {  // 同层节点可能共用一个过期的惰性数据源,先串行拉取
+            for (const auto& edge : node->m_sources) {
+              escalating(edge.node, [&] { edge.node->settle(); });
+            }
+          }
+          m_changed.assign(m_level.size(), 0);
+          m_pool->parallelFor(m_level.size(), [this](std::size_t i) {
+            if (!m_level[i]->dynamic()) {  // 动态依赖会改写上游的观察者列表,留到屏障后串行算
+              m_changed[i] = m_level[i]->valueChanged();
+            }
+          });
+          for (std::size_t i = 0; i < m_level.size(); ++i) {  // 屏障之后再统一把下游入队
+            if (m_level[i] && m_level[i]->dynamic()) {
+              m_changed[i] = evaluate(m_level[i]);
+            }
+            if (m_level[i]) {
+              afterEvaluate(m_level[i], depth, m_changed[i]);
+            }
+          }
+        } else {
+          for (std::size_t i = 0; i < m_level.size(); ++i) {
+            if (m_level[i]) {  // 可能被同层先算的节点销毁了
+              bool changed = evaluate(m_level[i]);  // 调用观察者的更新策略
+              afterEvaluate(m_level[i], depth, changed);
+            }
+          }
+        }
+      }
+      publish();
+    }
+
+    // 并行传播:同一层的节点数达到minLevel时在线程池上并发计算,层与层之间有屏障。
+    // 作为参数的惰性数据源在分发前串行拉取;要求计算函数不写var,也不在参数之外读惰性节点。
+    // 并发写入模式下各写线程的调度器沿用图的调度器上的设置,请在写线程启动前设置。
+    // 单线程策略下计数和锁都不是原子的,不能并行计算
+    void enableParallel(ThreadPool& pool, std::size_t minLevel = 64) {
+#ifdef REACTION_SINGLE_THREAD
+      throw std::logic_error("Parallel propagation needs the multi-thread policy.");
+#endif
+      m_pool = &pool;
+      m_minParallelLevel = std::max<std::size_t>(minLevel, 1);
+    }
+    void disableParallel() { m_pool = nullptr; }
+
+    // 批量更新期间只入队不传播,最外层批量结束时统一跑一轮
+    void beginBatch() { ++m_batchDepth; }
+    void endBatch() {
+      if (--m_batchDepth == 0) {
+        run();
+      }
+    }
+
+   private:
+    friend class ObserverGraph;
+    Scheduler() = default;
+
+    bool evaluate(ObserverNode* node) {
+      return escalating(node, [node] { return node->valueChanged(); });
+    }
+
+    // 并发写入模式下传播只持有一个分量的锁:计算中途读到别的分量时放弃这次计算,
+    // 换成独占整张图后重新计算。放锁期间别的写线程跳过还在队列里的节点,它们随后按新值计算
+    template <typename F>
+    static std::invoke_result_t<F&> escalating(ObserverNode* node, F&& fun);
+
+    void afterEvaluate(ObserverNode* node, std::size_t depth, bool changed) {
+      node->m_dirty = false;
+      if (changed) {
+        ++node->m_version;
+        recordChange(node);
+        scheduleObservers(node);
+      }
+      if (node->depth() > depth) {
+        schedule(node);  // 计算时依赖了更深的节点,等新的上游算完再算一次
+      }
+    }
+
+    struct Entry {
+      std::size_t depth;
+      ObserverNode* node;
+    };
+    struct DepthGreater {
+      bool operator()(const Entry& l, const Entry& r) const { return l.depth > r.depth; }
+    };
+
+    std::vector<Entry> m_queue;  // 按高度的小顶堆,自己维护以便把销毁的节点置空
+    std::vector<ObserverNode*> m_level;
+    void publish();
+
+    std::vector<char> m_changed;  // vector<bool>按位存储,并行写不安全
+    std::vector<ObserverNode*> m_published;  // 等待发布新版本的节点
+    ThreadPool* m_pool = nullptr;
+    std::size_t m_minParallelLevel = 64;
+    bool m_running = false;
+    int m_batchDepth = 0;
+  };
+
+  // 正在收集依赖的节点,React::operator()读取时把数据源登记给它
+  inline thread_local ObserverNode* g_tracker = nullptr;
+
+  struct RegGuard {
+    explicit RegGuard(ObserverNode* node) : m_prev(g_tracker) { g_tracker = node; }
+    ~RegGuard() { g_tracker = m_prev; }  // 嵌套计算(如拉取惰性节点)结束后恢复外层
+    ObserverNode* m_prev;
+  };
+
+  struct GraphOptions {
+    // 允许多个线程同时写var:按连通分量的条带锁串行化,不相交的子图可以并行传播。
+    // 建节点、reset和batch会独占整张图;()形式的calc在传播中新读到别的分量的节点时,
+    // 这一轮改为独占整张图,合并两个分量后重新计算该节点;
+    // 其他线程直接get()读取不加锁,需要一致的读取请在calc/action里读。
+    // 单线程策略(REACTION_SINGLE_THREAD)下条带锁是空锁,开启此选项时构造图会抛logic_error
+    bool concurrentWrites = false;
+    // 多版本快照:每轮传播结束发布一个epoch,Snapshot固定一个epoch做无锁的一致读取。
+    // 开启后lazyCalc也及时计算,否则发布出去的是标脏前的旧值
+    bool snapshots = false;
   };
 
-  using NodePtr = std::shared_ptr<ObserverNode>;
+  // 一张独立的图:自己的节点内存池、槽位表和调度器,不同的图之间不共享任何状态,
+  // 可以每个核/分片一张图各自运行;图必须比它的节点和句柄活得久
   class ObserverGraph {
    public:
-    static ObserverGraph& instance() {
-      static ObserverGraph instance;
-      return instance;
+    static constexpr std::size_t kStripes = 64;
+    static constexpr std::size_t kReaders = 64;  // 可同时存在的快照个数
+
+    explicit ObserverGraph(GraphOptions options = {}) : m_options(options) {
+#ifdef REACTION_SINGLE_THREAD
+      if (options.concurrentWrites) {
+        throw std::logic_error("Concurrent writes need the multi-thread policy.");
+      }
+#endif
+    }
+    ObserverGraph(const ObserverGraph&) = delete;
+    ObserverGraph& operator=(const ObserverGraph&) = delete;
+
+    // owned为false时只登记槽位,节点的生命周期由Region管理
+    void addNode(const NodePtr& node, bool owned = true) {
+      node->m_graph = this;
+      if (m_options.concurrentWrites) {
+        node->m_component = new Component;
+      }
+      node->m_handle = m_nodes.insert(node.get(), owned ? node : NodePtr{});
+    }
+
+    void removeNode(Handle handle) {
+      if (!m_options.concurrentWrites) {
+        NodePtr node = m_nodes.erase(handle);  // 节点在锁外析构
+        return;
+      }
+      ObserverNode* node = getNode(handle);
+      if (!node) {
+        return;
+      }
+      if (mustDefer(node)) {
+        defer([this, handle] { removeNode(handle); });
+        return;
+      }
+      exclusive(node, [&] { NodePtr owner = m_nodes.erase(handle); });  // 析构时会改上游的边
+    }
+
+    // 区域结束时一起释放一批节点:槽位表只加一次锁,并发写入模式下只独占一次整张图,
+    // 节点在锁内析构,断开与区域外节点的边
+    void removeNodes(std::vector<NodePtr> nodes) {
+      auto release = [&] {
+        std::vector<Handle> handles;
+        handles.reserve(nodes.size());
+        for (const auto& node : nodes) {
+          handles.push_back(node->m_handle);
+        }
+        auto owners = m_nodes.erase(handles);
+        owners.clear();
+        nodes.clear();
+      };
+      if (!m_options.concurrentWrites) {
+        release();
+        return;
+      }
+      if (mustDefer(nullptr)) {
+        defer([this, nodes = std::move(nodes)]() mutable { removeNodes(std::move(nodes)); });
+        return;
+      }
+      exclusive(nullptr, release);
+    }
+
+    // React句柄的热路径:下标加代数校验,不碰引用计数
+    ObserverNode* getNode(Handle handle) const { return m_nodes.get(handle); }
+
+    NodePool& pool() { return m_pool; }
+    Scheduler& scheduler() { return m_scheduler; }
+
+    // 本线程当前传播使用的调度器:并发写入模式下每个写线程各跑各的一轮
+    Scheduler& activeScheduler() {
+      if (m_options.concurrentWrites) {
+        thread_local Scheduler local;
+        local.m_pool = m_scheduler.m_pool;  // 并行设置在图的调度器上
+        local.m_minParallelLevel = m_scheduler.m_minParallelLevel;
+        return local;
+      }
+      return m_scheduler;
+    }
+
+    bool concurrent() const { return m_options.concurrentWrites; }
+    bool snapshots() const { return m_options.snapshots; }
+
+    // 一轮传播结束:变化的节点先挂上新版本再推进epoch,读者看到新epoch时新版本都已就绪;
+    // 然后回收所有读者都看不到的旧版本
+    void publish(const std::vector<ObserverNode*>& nodes) {
+      std::lock_guard<ThreadingPolicy::Mutex> lock(m_publishMutex);
+      std::uint64_t epoch = m_epoch.load(std::memory_order_relaxed) + 1;
+      for (auto* node : nodes) {
+        node->m_unpublished = false;
+        node->publishVersion(epoch);
+      }
+      m_epoch.store(epoch, std::memory_order_seq_cst);
+      for (auto* node : nodes) {
+        if (!node->m_retained) {
+          node->m_retained = true;
+          m_retained.push_back(node);
+        }
+      }
+      trimRetained(oldestPinned(epoch));
+    }
+
+    // 读者登记自己固定的epoch;登记后再确认epoch没变,
+    // 保证发布者要么看到这次登记,要么读者改用更新的epoch重试
+    std::uint64_t pin(std::size_t& slot) {
+      for (std::size_t i = 0;; i = (i + 1) % kReaders) {
+        std::uint64_t expected = 0;
+        std::uint64_t epoch = m_epoch.load(std::memory_order_seq_cst);
+        if (!m_readers[i].compare_exchange_strong(expected, epoch, std::memory_order_seq_cst)) {
+          if (i + 1 == kReaders) {
+            std::this_thread::yield();  // 快照槽位用完,等别的读者释放
+          }
+          continue;
+        }
+        while (m_epoch.load(std::memory_order_seq_cst) != epoch) {
+          epoch = m_epoch.load(std::memory_order_seq_cst);
+          m_readers[i].store(epoch, std::memory_order_seq_cst);
+        }
+        slot = i;
+        return epoch;
+      }
+    }
+    // 之后不再变化的节点不会再发布,它们的旧版本在最后一个看得到的读者释放时回收
+    void unpin(std::size_t slot) {
+      m_readers[slot].store(0, std::memory_order_seq_cst);
+      std::lock_guard<ThreadingPolicy::Mutex> lock(m_publishMutex);
+      trimRetained(oldestPinned(m_epoch.load(std::memory_order_seq_cst)));
+    }
+
+    void forgetVersions(ObserverNode* node) {
+      std::lock_guard<ThreadingPolicy::Mutex> lock(m_publishMutex);
+      if (node->m_retained) {
+        node->m_retained = false;
+        std::erase(m_retained, node);
+      }
+    }
+
+    // 持有node所在分量的锁执行fun,node为空时持有全部条带锁(改拓扑、批量更新);
+    // 已持有时直接执行,外层释放后再执行期间推迟的跨分量写入,fun抛异常时丢弃它们
+    template <typename F>
+    void exclusive(ObserverNode* node, F&& fun) {
+      if (holds(node)) {
+        std::forward<F>(fun)();
+        return;
+      }
+      if (t_held.graph) {
+        throw std::logic_error("Cannot change graph topology during a concurrent write.");
+      }
+      {
+        Component* root = node ? lockComponent(node) : lockAll();
+        struct Unlock {
+          ObserverGraph& self;
+          bool done = false;
+          ~Unlock() {
+            self.unlockHeld();  // 传播中可能已经升级成全部条带锁
+            if (!done) {
+              t_deferred.clear();
+            }
+          }
+        } unlock{*this};
+        t_held = {this, root};
+        std::forward<F>(fun)();
+        unlock.done = true;
+      }
+      runDeferred();
+    }
+
+    // ()读取数据源之前检查:传播中只持有一个分量的锁时,别的分量的值不能读,
+    // 抛出Escalate交给调度器升级锁后重新计算
+    void checkRead(ObserverNode* source) const {
+      if (t_held.graph == this && t_held.root && source->m_graph == this &&
+          source->m_component->root() != t_held.root) {
+        throw Escalate{};  // 别的图的节点留给link报错
+      }
     }
-    void addNode(NodePtr node) { m_nodes.insert(std::move(node)); }
 
-    void removeNode(const NodePtr& node) { m_nodes.erase(node); }
+    // 合并分量要改写并查集的父指针,只有独占整张图时才安全。
+    // 不在写入中的线程(如直接get()惰性节点)临时独占整张图来合并
+    void unite(ObserverNode* observer, ObserverNode* source) {
+      if (observer->m_component->root() == source->m_component->root()) {
+        return;  // 分量只合并不拆分,同根的结论不会过期
+      }
+      if (t_held.graph != this) {
+        exclusive(nullptr, [&] { Component::unite(source->m_component, observer->m_component); });
+        return;
+      }
+      if (t_held.root) {
+        throw Escalate{};
+      }
+      Component::unite(source->m_component, observer->m_component);
+    }
+
+    // 传播过程中写另一个分量的var不能就地加锁(两个写线程可能互相等待),推迟到本轮结束
+    bool mustDefer(ObserverNode* node) const { return t_held.graph && !holds(node); }
+    void defer(std::function<void()> task) { t_deferred.emplace_back(std::move(task)); }
 
    private:
-    ObserverGraph() = default;
-    std::unordered_set<NodePtr> m_nodes;
+    friend class Scheduler;
+
+    struct Held {
+      ObserverGraph* graph;
+      Component* root;  // 为空表示持有全部条带锁
+    };
+
+    // 传播需要独占整张图的信号,只在调度器里捕获,不是std::exception
+    struct Escalate {};
+
+    // 先放开本分量的锁再按固定顺序拿全部条带锁,不会与等着本分量的写线程互相等待
+    void escalate() {
+      stripe(t_held.root).unlock();
+      lockAll();
+      t_held.root = nullptr;
+    }
+
+    void unlockHeld() {
+      Component* root = std::exchange(t_held, Held{}).root;
+      if (root) {
+        stripe(root).unlock();
+      } else {
+        for (std::size_t i = kStripes; i > 0; --i) {
+          m_stripes[i - 1].unlock();
+        }
+      }
+    }
+
+    bool holds(ObserverNode* node) const {
+      if (t_held.graph != this) {
+        return false;
+      }
+      return !t_held.root || (node && node->m_component->root() == t_held.root);
+    }
+
+    ThreadingPolicy::Mutex& stripe(Component* root) {
+      auto key = reinterpret_cast<std::uintptr_t>(root) * UINT64_C(0x9E3779B97F4A7C15);
+      return m_stripes[static_cast<std::size_t>(key >> 58) % kStripes];
+    }
+
+    // 加锁后再确认根没变:等锁期间分量可能被合并到别的根下
+    Component* lockComponent(ObserverNode* node) {
+      for (;;) {
+        Component* root = node->m_component->root();
+        auto& mutex = stripe(root);
+        mutex.lock();
+        if (node->m_component->root() == root) {
+          return root;
+        }
+        mutex.unlock();
+      }
+    }
+
+    Component* lockAll() {
+      for (auto& mutex : m_stripes) {
+        mutex.lock();  // 固定顺序加锁,避免死锁
+      }
+      return nullptr;
+    }
+
+    std::uint64_t oldestPinned(std::uint64_t epoch) const {
+      for (auto& reader : m_readers) {
+        std::uint64_t pinned = reader.load(std::memory_order_seq_cst);
+        if (pinned != 0 && pinned < epoch) {
+          epoch = pinned;
+        }
+      }
+      return epoch;
+    }
+
+    // 持有m_publishMutex时调用
+    void trimRetained(std::uint64_t oldest) {
+      std::erase_if(m_retained, [oldest](ObserverNode* node) {
+        node->m_retained = node->trimVersions(oldest);
+        return !node->m_retained;
+      });
+    }
+
+    static void runDeferred() {
+      struct Clear {
+        ~Clear() { t_deferred.clear(); }  // 某个任务抛异常时丢弃剩下的
+      } clear;
+      while (!t_deferred.empty()) {
+        auto tasks = std::move(t_deferred);
+        t_deferred.clear();
+        for (auto& task : tasks) {
+          task();
+        }
+      }
+    }
+
+    inline static thread_local Held t_held{};
+    inline static thread_local std::vector<std::function<void()>> t_deferred;
+
+    GraphOptions m_options;
+    NodePool m_pool;  // 声明在槽位表之前,保证比图里的节点后析构
+    Scheduler m_scheduler;
+    std::array<ThreadingPolicy::Mutex, kStripes> m_stripes;
+    std::atomic<std::uint64_t> m_epoch{1};  // 0表示空闲的读者槽位
+    std::array<std::atomic<std::uint64_t>, kReaders> m_readers{};
+    ThreadingPolicy::Mutex m_publishMutex;
+    std::vector<ObserverNode*> m_retained;  // 版本链上还有旧版本的节点
+    SlotMap<ObserverNode, NodePtr> m_nodes;
   };
-}  // namespace reaction
\ No newline at end of file
+
+  inline ObserverNode::~ObserverNode() {
+    if (m_scheduler && (m_dirty || m_unpublished)) {
+      m_scheduler->cancel(this);
+    }
+    releaseTracked();
+    for (const auto& edge : m_sources) {
+      assert(agrees(edge, &ObserverNode::m_observers));
+      edge.node->dropObserver(edge.index);
+    }
+    for (const auto& edge : m_observers) {
+      assert(agrees(edge, &ObserverNode::m_sources));
+      edge.node->dropSource(edge.index);
+    }
+    if (m_component) {
+      m_component->release();
+    }
+  }
+
+  inline void ObserverNode::forgetVersions() {
+    if (m_graph && m_graph->snapshots()) {
+      m_graph->forgetVersions(this);
+    }
+  }
+
+  inline void ObserverNode::link(ObserverNode* source) {
+    if (source->m_graph != m_graph) {
+      throw std::logic_error("Cannot depend on a node of another graph.");  // 一轮传播只能在一张图里
+    }
+    if (source->m_component) {
+      m_graph->unite(this, source);  // 并发写入模式下两端并入同一分量
+    }
+    m_sources.push_back({source, source->m_observers.size()});
+    source->m_observers.push_back({this, m_sources.size() - 1});
+    assert(agrees(m_sources.back(), &ObserverNode::m_observers));
+    raiseDepth(source->m_depth + 1);  // 观察者的高度总要比数据源高
+  }
+
+  inline void ObserverNode::track(ObserverNode* source) {
+    if (source->m_component && source != this) {
+      m_graph->checkRead(source);  // 别的分量的标记也不能碰,先于去重检查
+    }
+    if (source != this && source->m_mark != m_trackMark) {
+      source->m_mark = m_trackMark;
+      source->retain();
+      m_tracked.emplace_back(source);
+    }
+  }
+
+  template <typename F>
+  std::invoke_result_t<F&> Scheduler::escalating(ObserverNode* node, F&& fun) {
+    try {
+      return fun();
+    } catch (const ObserverGraph::Escalate&) {
+      node->m_graph->escalate();
+      return fun();
+    }
+  }
+
+  inline void ObserverNode::notify() {
+    ++m_version;
+    auto& scheduler = m_graph->activeScheduler();
+    scheduler.recordChange(this);
+    scheduler.scheduleObservers(this);
+    scheduler.run();
+  }
+
+  inline void Scheduler::recordChange(ObserverNode* node) {
+    if (node->m_graph->snapshots() && !node->m_unpublished) {
+      node->m_unpublished = true;
+      node->m_scheduler = this;
+      m_published.push_back(node);
+    }
+  }
+
+  // 一轮传播只涉及一张图:写别的图的var走那张图自己的传播或被推迟
+  inline void Scheduler::publish() {
+    if (!m_published.empty()) {
+      m_published.front()->m_graph->publish(m_published);
+      m_published.clear();
+    }
+  }
+}  // namespace reaction
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace reaction {
+  // 线程策略:单线程的事件循环里计数和锁都不需要原子操作,编译期选择避免白白付出代价
+  struct NullMutex {
+    void lock() {}
+    bool try_lock() { return true; }
+    void unlock() {}
+  };
+
+  struct SingleThread {
+    using Mutex = NullMutex;
+  };
+
+  struct MultiThread {
+    using Mutex = std::mutex;
+  };
+
+  // 定义REACTION_SINGLE_THREAD后整个库使用非原子计数和空锁
+#ifdef REACTION_SINGLE_THREAD
+  using ThreadingPolicy = SingleThread;
+#else
+  using ThreadingPolicy = MultiThread;
+#endif
+
+  template <typename Policy = ThreadingPolicy>
+  class RefCount {
+   public:
+    void increment() { ++m_count; }
+    std::uint32_t decrement() { return --m_count; }  // 返回减一后的值
+    std::uint32_t load() const { return m_count; }
+
+   private:
+    std::uint32_t m_count = 0;
+  };
+
+  template <>
+  class RefCount<MultiThread> {
+   public:
+    void increment() { m_count.fetch_add(1, std::memory_order_relaxed); }
+    std::uint32_t decrement() { return m_count.fetch_sub(1, std::memory_order_acq_rel) - 1; }
+    std::uint32_t load() const { return m_count.load(std::memory_order_acquire); }
+
+   private:
+    std::atomic<std::uint32_t> m_count{0};
+  };
+}  // namespace reaction
@@ -1,20 +1,23 @@
-#include <atomic>
+#pragma once
+
 #include <functional>
+#include <map>
 #include <memory>
+#include <memory_resource>
+#include <new>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "expression.h"
+#include "reaction/collection.h"
+#include "reaction/immutable.h"
+#include "reaction/nodePool.h"
 #include "reaction/observerNode.h"
+#include "reaction/policy.h"
+#include "reaction/region.h"
 
 namespace reaction {
-  inline thread_local std::function<void(NodePtr)> g_reg_fun;
-
-  struct RegGuard {
-    RegGuard(const std::function<void(NodePtr)>& reg_fun) { g_reg_fun = reg_fun; }
-    ~RegGuard() { g_reg_fun = nullptr; }
-  };
-
   template <typename Type, typename... Args>
   class ReactImpl : public Expression<Type, Args...> {
    public:
@@ -23,43 +26,89 @@ namespace reaction {
     using ExprType = typename Expression<Type, Args...>::ExprType;
     using ValueType = typename Expression<Type, Args...>::ValueType;
 
-    decltype(auto) get() const { return this->getValue(); }
-    auto getRaw() const { return this->getRawPtr(); }
+    decltype(auto) get() {
+      if constexpr (std::is_same_v<ExprType, CalcExpressionTag>) {
+        this->pull();  // 惰性节点在这里才真正计算
+      }
+      return std::as_const(*this).getValue();  // 只读,修改要走value()或集合的接口
+    }
+    auto getRaw() {
+      if constexpr (std::is_same_v<ExprType, CalcExpressionTag>) {
+        this->pull();
+      }
+      return this->getRawPtr();
+    }
 
     template <typename F, HasArgs... A>
     void set(F&& fun, A&&... args) {
-      this->setSource(std::forward<F>(fun), std::forward<A>(args)...);
+      changeTopology([&] { this->setSource(std::forward<F>(fun), std::forward<A>(args)...); });
     }
 
     template <typename F>
     void set(F&& fun) {
-      // 数据源正在创建时,就进行赋值
-      RegGuard guard([this](NodePtr node) { this->addObCb(node); });  // 避免有return无法nullptr
-      this->setSource(std::forward<F>(fun));
+      changeTopology([&] { this->setSource(std::forward<F>(fun)); });  // 依赖在每次计算时由()收集
     }
 
     void set() {
-      RegGuard guard([this](NodePtr node) { this->addObCb(node); });  // 避免有return无法nullptr
-      this->setOpExpr();
+      changeTopology([&] { this->bindSources(); });
     }
 
     template <typename T>
       requires(ConvertCC<T, ValueType> && VarExprCC<VarExpressionTag> && !ConstType<ValueType>)
     void value(T&& t) {
-      this->updateValue(std::forward<T>(t));  // 要求类型可转换，且不是const类型,且是var类型
-      this->notify();
+      ObserverGraph* graph = this->graph();
+      if (!graph->concurrent()) {
+        assign(std::forward<T>(t));
+        return;
+      }
+      if (graph->mustDefer(this)) {
+        auto copy = std::make_shared<ValueType>(std::forward<T>(t));
+        graph->defer([self = NodeRef<ReactImpl>(this), copy] { self->value(std::move(*copy)); });
+        return;
+      }
+      graph->exclusive(this, [&] { assign(std::forward<T>(t)); });  // 只锁自己所在的分量
     }
-    void addWeakRef() { ++m_weakRefCount; }  // 引用计数增加
+    void addWeakRef() { m_weakRefCount.increment(); }  // 引用计数增加
 
     void removeWeakRef() {
-      if (--m_weakRefCount == 0) {
-        ObserverGraph::instance().removeNode(
-            this->shared_from_this());  // 引用计数为0时，从观察图中移除节点
+      if (m_weakRefCount.decrement() == 0 && !m_inRegion) {
+        this->graph()->removeNode(this->handle());  // 引用计数为0时，从观察图中移除节点
+      }
+    }
+
+    void setInRegion() { m_inRegion = true; }  // 区域里的节点随区域一起释放
+
+   protected:
+    void destroy() override {
+      std::pmr::memory_resource* memory = this->m_memory;
+      if (!memory) {
+        delete this;
+        return;
       }
+      this->~ReactImpl();
+      memory->deallocate(this, sizeof(ReactImpl), alignof(ReactImpl));  // 还给分配它的内存池
     }
 
    private:
-    std::atomic<int> m_weakRefCount{0};
+    template <typename T>
+    void assign(T&& t) {
+      if (this->updateValue(std::forward<T>(t))) {  // 要求类型可转换，且不是const类型,且是var类型
+        this->notify();
+      }
+    }
+
+    // 建立依赖边会合并连通分量,并发写入模式下要停下所有写线程
+    template <typename F>
+    void changeTopology(F&& fun) {
+      if (this->graph()->concurrent()) {
+        this->graph()->exclusive(nullptr, std::forward<F>(fun));
+      } else {
+        std::forward<F>(fun)();
+      }
+    }
+
+    RefCount<> m_weakRefCount;  // React句柄的个数
+    bool m_inRegion = false;
   };
 
   template <typename ReactType>
@@ -68,53 +117,54 @@ namespace reaction {
     using ValueType = typename ReactType::ValueType;
 
     // ReactImpl<std::decay_t<T>> == ReactType
-    explicit React(std::shared_ptr<ReactType> ptr) : m_weakPtr(std::move(ptr)) {
-      if (auto sharedPtr = m_weakPtr.lock()) {
-        sharedPtr->addWeakRef();
-      }
+    // 句柄只记录所属的图和槽位下标、代数,读取时在图里校验,不再lock weak_ptr
+    explicit React(const NodeRef<ReactType>& ptr) : m_graph(ptr->graph()), m_handle(ptr->handle()) {
+      ptr->addWeakRef();
     }
     ~React() {
-      if (auto sharedPtr = m_weakPtr.lock()) {
-        sharedPtr->removeWeakRef();
+      if (auto* ptr = find()) {
+        ptr->removeWeakRef();
       }
     }
-    React(const React& other) : m_weakPtr(other.m_weakPtr) {
-      if (auto sharedPtr = m_weakPtr.lock()) {
-        sharedPtr->addWeakRef();
+    React(const React& other) : m_graph(other.m_graph), m_handle(other.m_handle) {
+      if (auto* ptr = find()) {
+        ptr->addWeakRef();
       }
     }
-    React(React&& other) noexcept : m_weakPtr(std::move(other.m_weakPtr)) {
-      other.m_weakPtr.reset();
+    React(React&& other) noexcept : m_graph(other.m_graph), m_handle(other.m_handle) {
+      other.m_handle = Handle{};
     }
     React& operator=(const React& other) {
       if (this != &other) {
-        if (auto sharedPtr = m_weakPtr.lock()) {
-          sharedPtr->removeWeakRef();
+        if (auto* ptr = find()) {
+          ptr->removeWeakRef();
         }
-        m_weakPtr = other.m_weakPtr;
-        if (auto sharedPtr = m_weakPtr.lock()) {
-          sharedPtr->addWeakRef();
+        m_graph = other.m_graph;
+        m_handle = other.m_handle;
+        if (auto* ptr = find()) {
+          ptr->addWeakRef();
         }
       }
       return *this;
     }
     React& operator=(React&& other) noexcept {
       if (this != &other) {
-        if (auto sharedPtr = m_weakPtr.lock()) {
-          sharedPtr->removeWeakRef();
+        if (auto* ptr = find()) {
+          ptr->removeWeakRef();
         }
-        m_weakPtr = std::move(other.m_weakPtr);
-        other.m_weakPtr.reset();
+        m_graph = other.m_graph;
+        m_handle = other.m_handle;
+        other.m_handle = Handle{};
       }
       return *this;
     }
-    auto operator->() const { return getSharedPtr()->getRaw(); }
+    auto operator->() const { return getPtr()->getRaw(); }
 
-    explicit operator bool() const { return !m_weakPtr.expired(); }
+    explicit operator bool() const { return find() != nullptr; }
 
     decltype(auto) operator()() const {
-      if (g_reg_fun) {
-        std::invoke(g_reg_fun, this->getSharedPtr());
+      if (g_tracker) {
+        g_tracker->track(getPtr());  // 登记给正在计算的节点
       }
       return get();
     }
@@ -122,64 +172,304 @@ namespace reaction {
     decltype(auto) get() const
     // requires IsDataReact<ReactType>
     {
-      return getSharedPtr()->get();  // Impl的get 获取resource的值,需要是有值的才能有get
+      return getPtr()->get();  // Impl的get 获取resource的值,需要是有值的才能有get
     }
 
     template <typename F, typename... A>
     void reset(F&& t, A&&... args) {
-      return getSharedPtr()->set(std::forward<F>(t), std::forward<A>(args)...);
+      return getPtr()->set(std::forward<F>(t), std::forward<A>(args)...);
     }
     // 更新值
     template <typename T>
     void value(T&& t) {
-      getSharedPtr()->value(std::forward<T>(t));
+      getPtr()->value(std::forward<T>(t));
+    }
+    // 设置触发策略:AlwaysTrig、ChangeTrig或自定义比较器
+    template <typename T>
+    void trigger(T&& t) {
+      getPtr()->setTrigger(std::forward<T>(t));
     }
 
-    std::shared_ptr<ReactType> getSharedPtr() const {
-      auto sharedPtr = m_weakPtr.lock();
-      if (!sharedPtr) {
+    ReactType* getPtr() const {
+      if (!m_handle.valid()) {
         throw std::runtime_error("Attempt to access a moved-from React object.");
       }
-      return sharedPtr;
+      auto* ptr = find();
+      if (!ptr) {
+        throw std::runtime_error("Attempt to access a destroyed React object.");
+      }
+      return ptr;
+    }
+
+    // 只在建立依赖时使用,calc需要持有数据源的所有权
+    NodeRef<ReactType> getSharedPtr() const { return NodeRef<ReactType>(getPtr()); }
+
+    Handle handle() const { return m_handle; }
+    ObserverGraph* graph() const { return m_graph; }
+
+   private:
+    ReactType* find() const { return static_cast<ReactType*>(m_graph->getNode(m_handle)); }
+
+    ObserverGraph* m_graph;
+    Handle m_handle;
+  };
+
+  // 节点从所属图的NodePool分配,避免每个节点一次通用堆分配;
+  // 有活动的Region时改从它的Arena分配并交给它持有,而不是由观察图持有
+  template <typename Node, typename... Args>
+  NodeRef<Node> makeNode(ObserverGraph& graph, Args&&... args) {
+    Region* region = Region::current();
+    std::pmr::memory_resource* memory =
+        region ? static_cast<std::pmr::memory_resource*>(&region->arena()) : &graph.pool();
+    void* block = memory->allocate(sizeof(Node), alignof(Node));
+    Node* node = nullptr;
+    try {
+      node = new (block) Node(std::forward<Args>(args)...);
+    } catch (...) {
+      memory->deallocate(block, sizeof(Node), alignof(Node));
+      throw;
+    }
+    node->setMemory(memory);
+
+    NodeRef<Node> ptr(node);
+    if (region) {
+      ptr->setInRegion();
+      graph.addNode(ptr, false);
+      region->adopt(ptr);
+    } else {
+      graph.addNode(ptr);  // 将节点加入观察图
+    }
+    return ptr;
+  }
+
+  // 带工厂方法的图:同一张图的节点才能互相依赖,依赖另一张图的节点会抛logic_error;
+  // 自由函数var/calc等使用进程内的默认图
+  class Graph : public ObserverGraph {
+   public:
+    using ObserverGraph::ObserverGraph;
+
+    static Graph& instance() {
+      static Graph instance;
+      return instance;
+    }
+
+    template <typename T>
+    auto var(T&& t) {
+      auto ptr = makeNode<ReactImpl<std::decay_t<T>>>(*this, std::forward<T>(t));
+      return wrap(ptr);
+    }
+
+    template <typename T>
+    auto constVar(T&& t) {
+      auto ptr = makeNode<ReactImpl<const std::decay_t<T>>>(*this, std::forward<T>(t));
+      return wrap(ptr);
+    }
+
+    template <typename Func, typename... Args>
+    auto calc(Func&& fun, Args&&... args) {
+      auto ptr = makeNode<ReactImpl<std::decay_t<Func>, std::decay_t<Args>...>>(*this);
+      ptr->set(std::forward<Func>(fun), std::forward<Args>(args)...);
+      return wrap(ptr);
+    }
+
+    // 惰性计算节点:上游变化只标脏,get()或()时才调用fun。
+    // 快照模式下每轮结束都要发布最新值,惰性节点退化为及时计算
+    template <typename Func, typename... Args>
+    auto lazyCalc(Func&& fun, Args&&... args) {
+      auto ptr = makeNode<ReactImpl<std::decay_t<Func>, std::decay_t<Args>...>>(*this);
+      if (!snapshots()) {
+        ptr->setLazy();
+      }
+      ptr->set(std::forward<Func>(fun), std::forward<Args>(args)...);
+      return wrap(ptr);
+    }
+
+    // 整棵树在构造时已折叠成常量的,直接建成constVar
+    template <typename Expr>
+    auto expr(Expr&& opExpr) {
+      if constexpr (IsValueWrapper<std::decay_t<Expr>>::value) {
+        return constVar(opExpr());
+      } else {
+        auto ptr = makeNode<ReactImpl<std::decay_t<Expr>>>(*this, std::forward<Expr>(opExpr));
+        ptr->set();
+        return wrap(ptr);
+      }
+    }
+
+    template <typename Func, typename... Args>
+    auto action(Func&& fun, Args&&... args) {
+      return calc(std::forward<Func>(fun), std::forward<Args>(args)...);
+    }
+
+    // 增量集合的数据源:通过->修改,每次修改只把变化传给下游
+    template <typename T>
+    auto reactiveVector(std::vector<T> values = {}) {
+      return wrap(makeNode<ReactImpl<ListSource<T>>>(*this, std::move(values)));
+    }
+
+    template <typename K, typename V>
+    auto reactiveMap(std::map<K, V> values = {}) {
+      return wrap(makeNode<ReactImpl<MapSource<K, V>>>(*this, std::move(values)));
+    }
+
+    // 增量集合的派生节点,source是reactiveVector、reactiveMap或另一个派生集合
+    template <typename Source, typename Func>
+    auto mapped(const React<Source>& source, Func&& fun) {
+      return view<Mapped<Source, std::decay_t<Func>>>(source, std::forward<Func>(fun));
+    }
+
+    template <typename Source, typename Pred>
+    auto filtered(const React<Source>& source, Pred&& pred) {
+      return view<Filtered<Source, std::decay_t<Pred>>>(source, std::forward<Pred>(pred));
+    }
+
+    template <typename Source, typename Cmp = std::less<>>
+    auto sorted(const React<Source>& source, Cmp&& cmp = {}) {
+      return view<Sorted<Source, std::decay_t<Cmp>>>(source, std::forward<Cmp>(cmp));
+    }
+
+    // 只支持按键的集合
+    template <typename Source, typename Func>
+    auto groupBy(const React<Source>& source, Func&& fun) {
+      return view<Grouped<Source, std::decay_t<Func>>>(source, std::forward<Func>(fun));
+    }
+
+    // 按键的集合之间的等值连接:leftKey(左值)==rightKey(右值)的元素配对
+    template <typename Left, typename Right, typename FL, typename FR>
+    auto join(const React<Left>& left, const React<Right>& right, FL&& leftKey, FR&& rightKey) {
+      auto ptr = makeNode<ReactImpl<Joined<Left, Right, std::decay_t<FL>, std::decay_t<FR>>>>(
+          *this, left.getSharedPtr(), right.getSharedPtr(), std::forward<FL>(leftKey),
+          std::forward<FR>(rightKey));
+      ptr->set();
+      return wrap(ptr);
+    }
+
+    // 分组聚合,agg是Sum{fun}、Count{}、Min{fun}或Max{fun}
+    template <typename Source, typename Func, typename Agg>
+    auto aggregate(const React<Source>& source, Func&& fun, Agg&& agg) {
+      auto ptr = makeNode<ReactImpl<Aggregated<Source, std::decay_t<Func>, std::decay_t<Agg>>>>(
+          *this, source.getSharedPtr(), std::forward<Func>(fun), std::forward<Agg>(agg));
+      ptr->set();
+      return wrap(ptr);
+    }
+
+    // 批量更新:fun中对本图var的多次赋值只标脏,结束时合并成一轮传播;
+    // 并发写入模式下批量更新期间独占整张图
+    template <typename Func>
+    void batch(Func&& fun) {
+      if (concurrent()) {
+        exclusive(nullptr, [&] { runBatch(std::forward<Func>(fun)); });
+      } else {
+        runBatch(std::forward<Func>(fun));
+      }
     }
 
    private:
-    std::weak_ptr<ReactType> m_weakPtr;
+    // 快照模式下新节点的初始值也要发布,否则快照里读不到它
+    template <typename Node>
+    auto wrap(const NodeRef<Node>& ptr) {
+      if (snapshots()) {
+        auto& scheduler = activeScheduler();
+        scheduler.recordChange(ptr.get());
+        scheduler.run();  // 传播或批量更新中只记录,随本轮一起发布
+      }
+      return React(ptr);
+    }
+
+    template <typename Desc, typename Source, typename F>
+    auto view(const React<Source>& source, F&& fun) {
+      auto ptr = makeNode<ReactImpl<Desc>>(*this, source.getSharedPtr(), std::forward<F>(fun));
+      ptr->set();
+      return wrap(ptr);
+    }
+
+    template <typename Func>
+    void runBatch(Func&& fun) {
+      auto& scheduler = activeScheduler();
+      scheduler.beginBatch();
+      try {
+        std::invoke(std::forward<Func>(fun));
+      } catch (...) {
+        scheduler.endBatch();  // 已写入的值仍然要传播出去
+        throw;
+      }
+      scheduler.endBatch();
+    }
   };
 
   template <typename T>
   auto var(T&& t) {
-    auto ptr = std::make_shared<ReactImpl<std::decay_t<T>>>(std::forward<T>(t));
-    ObserverGraph::instance().addNode(ptr);  // 将节点加入观察图
-    return React(ptr);
+    return Graph::instance().var(std::forward<T>(t));
   }
 
   template <typename T>
   auto constVar(T&& t) {
-    auto ptr = std::make_shared<ReactImpl<const std::decay_t<T>>>(std::forward<T>(t));
-    ObserverGraph::instance().addNode(ptr);
-    return React(ptr);
+    return Graph::instance().constVar(std::forward<T>(t));
   }
 
   template <typename Func, typename... Args>
   auto calc(Func&& fun, Args&&... args) {
-    auto ptr = std::make_shared<ReactImpl<std::decay_t<Func>, std::decay_t<Args>...>>();
-    ObserverGraph::instance().addNode(ptr);
-    ptr->set(std::forward<Func>(fun), std::forward<Args>(args)...);
-    return React(ptr);
+    return Graph::instance().calc(std::forward<Func>(fun), std::forward<Args>(args)...);
+  }
+
+  template <typename Func, typename... Args>
+  auto lazyCalc(Func&& fun, Args&&... args) {
+    return Graph::instance().lazyCalc(std::forward<Func>(fun), std::forward<Args>(args)...);
   }
 
-  template <typename OpExpr>
-  auto expr(OpExpr&& opExpr) {
-    auto ptr = std::make_shared<ReactImpl<std::decay_t<OpExpr>>>(std::forward<OpExpr>(opExpr));
-    ObserverGraph::instance().addNode(ptr);
-    ptr->set();
-    return React(ptr);
+  template <typename Expr>
+  auto expr(Expr&& opExpr) {
+    return Graph::instance().expr(std::forward<Expr>(opExpr));
   }
 
   template <typename Func, typename... Args>
   auto action(Func&& fun, Args&&... args) {
-    return calc(std::forward<Func>(fun), std::forward<Args>(args)...);
+    return Graph::instance().action(std::forward<Func>(fun), std::forward<Args>(args)...);
+  }
+
+  template <typename Func>
+  void batch(Func&& fun) {
+    Graph::instance().batch(std::forward<Func>(fun));
+  }
+
+  template <typename T>
+  auto reactiveVector(std::vector<T> values = {}) {
+    return Graph::instance().reactiveVector(std::move(values));
+  }
+
+  template <typename K, typename V>
+  auto reactiveMap(std::map<K, V> values = {}) {
+    return Graph::instance().reactiveMap(std::move(values));
+  }
+
+  template <typename Source, typename Func>
+  auto mapped(const React<Source>& source, Func&& fun) {
+    return Graph::instance().mapped(source, std::forward<Func>(fun));
+  }
+
+  template <typename Source, typename Pred>
+  auto filtered(const React<Source>& source, Pred&& pred) {
+    return Graph::instance().filtered(source, std::forward<Pred>(pred));
+  }
+
+  template <typename Source, typename Cmp = std::less<>>
+  auto sorted(const React<Source>& source, Cmp&& cmp = {}) {
+    return Graph::instance().sorted(source, std::forward<Cmp>(cmp));
+  }
+
+  template <typename Source, typename Func>
+  auto groupBy(const React<Source>& source, Func&& fun) {
+    return Graph::instance().groupBy(source, std::forward<Func>(fun));
+  }
+
+  template <typename Left, typename Right, typename FL, typename FR>
+  auto join(const React<Left>& left, const React<Right>& right, FL&& leftKey, FR&& rightKey) {
+    return Graph::instance().join(left, right, std::forward<FL>(leftKey), std::forward<FR>(rightKey));
+  }
+
+  template <typename Source, typename Func, typename Agg>
+  auto aggregate(const React<Source>& source, Func&& fun, Agg&& agg) {
+    return Graph::instance().aggregate(source, std::forward<Func>(fun), std::forward<Agg>(agg));
   }
 
-}  // namespace reaction
\ No newline at end of file
+}  // namespace reaction
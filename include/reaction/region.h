@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+#include "observerNode.h"
+#include "policy.h"
+
+namespace reaction {
+  // 只增不减的区域内存:分配只是移动指针,释放不回收,整块内存在区域和所有块都释放后一次性归还
+  class Arena : public std::pmr::memory_resource {
+   public:
+    static constexpr std::size_t kAlign = alignof(std::max_align_t);
+    static constexpr std::size_t kChunkSize = 64 * 1024;
+
+    Arena() { m_refs.increment(); }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // 节点可能被数据源的依赖边拖到区域结束之后才释放,所以用计数决定何时真正归还内存
+    void release() { unref(); }
+
+   private:
+    ~Arena() override = default;
+
+    void* do_allocate(std::size_t size, std::size_t alignment) override {
+      if (alignment > kAlign) {
+        throw std::bad_alloc();
+      }
+      size = (size + kAlign - 1) / kAlign * kAlign;
+      if (static_cast<std::size_t>(m_end - m_cur) < size) {
+        std::size_t chunkSize = std::max(size, kChunkSize);
+        m_chunks.emplace_back(new std::byte[chunkSize]);  // new[]保证max_align_t对齐
+        m_cur = m_chunks.back().get();
+        m_end = m_cur + chunkSize;
+      }
+      m_refs.increment();
+      void* block = m_cur;
+      m_cur += size;
+      return block;
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override { unref(); }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+      return this == &other;
+    }
+
+    void unref() {
+      if (m_refs.decrement() == 0) {
+        delete this;
+      }
+    }
+
+    std::vector<std::unique_ptr<std::byte[]>> m_chunks;
+    std::byte* m_cur = nullptr;
+    std::byte* m_end = nullptr;
+    RefCount<> m_refs;  // 区域本身持有一份
+  };
+
+  // 图区域:区域存活期间当前线程创建的节点都从它的Arena分配并由它持有。
+  // 区域结束时每张图的槽位只加一次锁批量删除,内存整块归还;
+  // 节点析构时仍要逐条断开自己的边(每条O(1)),被区域外持有的节点还要继续工作
+  class Region {
+   public:
+    Region() : m_arena(new Arena), m_prev(t_current) { t_current = this; }
+    Region(const Region&) = delete;
+    Region& operator=(const Region&) = delete;
+
+    ~Region() {
+      t_current = m_prev;
+      while (!m_nodes.empty()) {  // 按所属的图分批,旧句柄随之失效
+        ObserverGraph* graph = m_nodes.front()->graph();
+        auto mid = std::stable_partition(m_nodes.begin(), m_nodes.end(),
+                                         [graph](const NodePtr& node) { return node->graph() == graph; });
+        std::vector<NodePtr> batch(std::make_move_iterator(m_nodes.begin()),
+                                   std::make_move_iterator(mid));
+        m_nodes.erase(m_nodes.begin(), mid);
+        graph->removeNodes(std::move(batch));
+      }
+      m_arena->release();
+    }
+
+    static Region* current() { return t_current; }
+
+    Arena& arena() { return *m_arena; }
+    void adopt(NodePtr node) { m_nodes.emplace_back(std::move(node)); }
+    std::size_t size() const { return m_nodes.size(); }
+
+   private:
+    inline static thread_local Region* t_current = nullptr;
+
+    Arena* m_arena;
+    Region* m_prev;
+    std::vector<NodePtr> m_nodes;
+  };
+}  // namespace reaction
@@ -1,47 +1,216 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <stdexcept>
+#include <utility>
 
 #include "observerNode.h"
 namespace reaction {
+  // 触发策略:AlwaysTrig每次赋值都向下游传播,ChangeTrig只在operator==认为值变化时传播
+  struct AlwaysTrig {};
+  struct ChangeTrig {};
+
+  // 浮点数按误差比较,配合自定义比较器的触发策略使用
+  struct ApproxEqual {
+    double epsilon = 1e-9;
+    bool operator()(double a, double b) const { return std::abs(a - b) <= epsilon; }
+  };
+
+  // 节点里值的存储:小对象直接内联在节点内,省一次堆分配和一次指针跳转;
+  // 超过阈值的大对象仍放在堆上,避免把节点撑大、拖慢遍历观察者时的缓存
+  inline constexpr std::size_t kInlineValueSize = 128;
+
+  template <typename Type, bool Inline = (sizeof(Type) <= kInlineValueSize)>
+  class ValueStorage {
+   public:
+    explicit operator bool() const { return m_value.has_value(); }
+    Type* get() { return &*m_value; }
+    const Type* get() const { return &*m_value; }
+
+    template <typename T>
+    void emplace(T&& t) {
+      m_value.emplace(std::forward<T>(t));
+    }
+
+   private:
+    std::optional<Type> m_value;
+  };
+
+  template <typename Type>
+  class ValueStorage<Type, false> {
+   public:
+    explicit operator bool() const { return m_ptr != nullptr; }
+    Type* get() { return m_ptr.get(); }
+    const Type* get() const { return m_ptr.get(); }
+
+    template <typename T>
+    void emplace(T&& t) {
+      m_ptr = std::make_unique<Type>(std::forward<T>(t));
+    }
+
+   private:
+    std::unique_ptr<Type> m_ptr;
+  };
+
   template <typename Type>
   class Resource : public ObserverNode {
    public:
-    Resource() : m_ptr(nullptr) {}
+    Resource() = default;
 
     template <typename T>
-    Resource(T&& t) : m_ptr(std::make_unique<Type>(std::forward<T>(t))) {}
+    Resource(T&& t) {
+      m_value.emplace(std::forward<T>(t));
+    }
     Resource(const Resource&) = delete;
     Resource& operator=(const Resource&) = delete;
 
     Resource(Resource&&) = default;
     Resource& operator=(Resource&&) = default;  // 禁止拷贝，允许移动
 
-    Type& getValue() const {
-      if (!m_ptr) {
+    ~Resource() override {
+      this->forgetVersions();
+      deleteVersions(m_versions.load(std::memory_order_relaxed));
+    }
+
+    Type& getValue() { return *getRawPtr(); }
+    const Type& getValue() const {
+      if (!m_value) {
         throw std::runtime_error("Resource is not initialized");
       }
-      return *m_ptr;
+      return *m_value.get();
     }
 
-    Type* getRawPtr() const {
-      if (!m_ptr) {
+    Type* getRawPtr() {
+      if (!m_value) {
         throw std::runtime_error("Resource is not initialized");
       }
-      return m_ptr.get();
+      return m_value.get();
     }
 
+    void setTrigger(AlwaysTrig) {
+      m_trigger = Trigger::Always;
+      m_equal = nullptr;
+    }
+
+    void setTrigger(ChangeTrig)
+      requires std::equality_comparable<Type>
+    {
+      m_trigger = Trigger::Change;
+      m_equal = nullptr;
+    }
+
+    template <typename Cmp>
+      requires std::predicate<Cmp, const Type&, const Type&>
+    void setTrigger(Cmp&& cmp) {
+      m_trigger = Trigger::Custom;
+      m_equal = std::forward<Cmp>(cmp);
+    }
+
+    // 返回值是否发生变化,未变化时调用方不再通知下游
     template <typename T>
-    void updateValue(T&& t) {
-      if (!m_ptr) {
-        m_ptr = std::make_unique<Type>(std::forward<T>(t));
-      } else {
-        *m_ptr = std::forward<T>(t);  // 否则移动构造会reset
+    bool updateValue(T&& t) {
+      if (!m_value) {
+        m_value.emplace(std::forward<T>(t));
+        return true;
+      }
+      if (isSame(t)) {
+        return false;
+      }
+      *m_value.get() = std::forward<T>(t);  // 原地赋值,不重新分配
+      return true;
+    }
+
+    // 快照读取:epoch时刻可见的版本,即不晚于epoch的最新版本;
+    // 节点在快照之后才创建时没有更早的版本,读到的是它的初始值
+    const Type& versionAt(std::uint64_t epoch) const {
+      Version* version = m_versions.load(std::memory_order_acquire);
+      if (!version) {
+        throw std::runtime_error("No published version, is the graph created with snapshots?");
+      }
+      while (version->epoch > epoch) {
+        Version* prev = version->prev.load(std::memory_order_acquire);
+        if (!prev) {
+          break;
+        }
+        version = prev;
+      }
+      return version->value;
+    }
+
+    void publishVersion(std::uint64_t epoch) override {
+      if constexpr (std::copy_constructible<Type>) {
+        if (m_value) {
+          auto* version = new Version{epoch, *m_value.get()};
+          version->prev.store(m_versions.load(std::memory_order_relaxed), std::memory_order_relaxed);
+          m_versions.store(version, std::memory_order_release);
+        }
+      }
+    }
+
+    // 保留不晚于minEpoch的最新版本,它之前的版本已没有读者能看到
+    bool trimVersions(std::uint64_t minEpoch) override {
+      Version* head = m_versions.load(std::memory_order_relaxed);
+      Version* version = head;
+      while (version && version->epoch > minEpoch) {
+        version = version->prev.load(std::memory_order_relaxed);
       }
+      if (version) {
+        deleteVersions(version->prev.exchange(nullptr, std::memory_order_acq_rel));
+      }
+      return head && head->prev.load(std::memory_order_relaxed);
+    }
+
+    std::size_t versionCount() const {
+      std::size_t count = 0;
+      for (Version* version = m_versions.load(std::memory_order_acquire); version;
+           version = version->prev.load(std::memory_order_acquire)) {
+        ++count;
+      }
+      return count;
     }
 
    private:
-    std::unique_ptr<Type> m_ptr;
+    enum class Trigger : std::uint8_t { Always, Change, Custom };
+
+    struct Version {
+      std::uint64_t epoch;
+      Type value;
+      std::atomic<Version*> prev{nullptr};
+    };
+
+    static void deleteVersions(Version* version) {
+      while (version) {
+        delete std::exchange(version, version->prev.load(std::memory_order_relaxed));
+      }
+    }
+
+    template <typename T>
+    bool isSame(const T& t) const {
+      switch (m_trigger) {
+        case Trigger::Change:
+          if constexpr (std::equality_comparable<Type>) {
+            return *m_value.get() == t;
+          }
+          return false;
+        case Trigger::Custom:
+          return m_equal(*m_value.get(), t);
+        default:
+          return false;
+      }
+    }
+
+    ValueStorage<Type> m_value;
+    Trigger m_trigger = Trigger::Always;
+    std::function<bool(const Type&, const Type&)> m_equal;
+    std::atomic<Version*> m_versions{nullptr};  // 快照模式下的版本链,从新到旧
   };
 
   struct VoidWrapper {};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstddef>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define REACTION_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define REACTION_X86_SIMD 0
+#endif
+
+namespace reaction::simd {
+  // double数组的逐元素内核:运行时检测CPU,AVX2一次算4个,SSE2一次算2个,其余标量
+  enum class Isa { Scalar, Sse2, Avx2 };
+
+  inline Isa detectIsa() {
+#if REACTION_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+      return Isa::Avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+      return Isa::Sse2;
+    }
+#endif
+    return Isa::Scalar;
+  }
+
+  // 当前使用的指令集,首次使用时检测;测试时可以改成更低的指令集对比结果
+  inline Isa& activeIsa() {
+    static Isa isa = detectIsa();
+    return isa;
+  }
+
+  enum class Kind { Add, Sub, Mul, Div, Lt, Le, Gt, Ge, Eq, Ne };
+
+  inline double scalarOp(Kind kind, double x, double y) {
+    switch (kind) {
+      case Kind::Add:
+        return x + y;
+      case Kind::Sub:
+        return x - y;
+      case Kind::Mul:
+        return x * y;
+      case Kind::Div:
+        return x / y;
+      case Kind::Lt:
+        return x < y;
+      case Kind::Le:
+        return x <= y;
+      case Kind::Gt:
+        return x > y;
+      case Kind::Ge:
+        return x >= y;
+      case Kind::Eq:
+        return x == y;
+      default:
+        return x != y;
+    }
+  }
+
+  // a、b的步长为0时表示广播标量;比较结果写成1.0/0.0的掩码
+  inline void scalarBinary(Kind kind, const double* a, std::size_t sa, const double* b,
+                           std::size_t sb, double* out, std::size_t begin, std::size_t n) {
+    const double* x = a + begin * sa;
+    const double* y = b + begin * sb;
+    for (double* dst = out + begin; dst < out + n; ++dst, x += sa, y += sb) {
+      *dst = scalarOp(kind, *x, *y);
+    }
+  }
+
+#if REACTION_X86_SIMD
+  template <Kind K>
+  __attribute__((target("avx2"))) void loopAvx2(const double* a, std::size_t sa, const double* b,
+                                                std::size_t sb, double* out, std::size_t n) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m256d x = sa ? _mm256_loadu_pd(a + i) : _mm256_set1_pd(*a);
+      __m256d y = sb ? _mm256_loadu_pd(b + i) : _mm256_set1_pd(*b);
+      __m256d r;
+      if constexpr (K == Kind::Add) {
+        r = _mm256_add_pd(x, y);
+      } else if constexpr (K == Kind::Sub) {
+        r = _mm256_sub_pd(x, y);
+      } else if constexpr (K == Kind::Mul) {
+        r = _mm256_mul_pd(x, y);
+      } else if constexpr (K == Kind::Div) {
+        r = _mm256_div_pd(x, y);
+      } else if constexpr (K == Kind::Lt) {
+        r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_LT_OQ), one);
+      } else if constexpr (K == Kind::Le) {
+        r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_LE_OQ), one);
+      } else if constexpr (K == Kind::Gt) {
+        r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_GT_OQ), one);
+      } else if constexpr (K == Kind::Ge) {
+        r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_GE_OQ), one);
+      } else if constexpr (K == Kind::Eq) {
+        r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_EQ_OQ), one);
+      } else {
+        r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_NEQ_UQ), one);
+      }
+      _mm256_storeu_pd(out + i, r);
+    }
+    scalarBinary(K, a, sa, b, sb, out, i, n);
+  }
+
+  template <Kind K>
+  __attribute__((target("sse2"))) void loopSse2(const double* a, std::size_t sa, const double* b,
+                                                std::size_t sb, double* out, std::size_t n) {
+    const __m128d one = _mm_set1_pd(1.0);
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+      __m128d x = sa ? _mm_loadu_pd(a + i) : _mm_set1_pd(*a);
+      __m128d y = sb ? _mm_loadu_pd(b + i) : _mm_set1_pd(*b);
+      __m128d r;
+      if constexpr (K == Kind::Add) {
+        r = _mm_add_pd(x, y);
+      } else if constexpr (K == Kind::Sub) {
+        r = _mm_sub_pd(x, y);
+      } else if constexpr (K == Kind::Mul) {
+        r = _mm_mul_pd(x, y);
+      } else if constexpr (K == Kind::Div) {
+        r = _mm_div_pd(x, y);
+      } else if constexpr (K == Kind::Lt) {
+        r = _mm_and_pd(_mm_cmplt_pd(x, y), one);
+      } else if constexpr (K == Kind::Le) {
+        r = _mm_and_pd(_mm_cmple_pd(x, y), one);
+      } else if constexpr (K == Kind::Gt) {
+        r = _mm_and_pd(_mm_cmpgt_pd(x, y), one);
+      } else if constexpr (K == Kind::Ge) {
+        r = _mm_and_pd(_mm_cmpge_pd(x, y), one);
+      } else if constexpr (K == Kind::Eq) {
+        r = _mm_and_pd(_mm_cmpeq_pd(x, y), one);
+      } else {
+        r = _mm_and_pd(_mm_cmpneq_pd(x, y), one);
+      }
+      _mm_storeu_pd(out + i, r);
+    }
+    scalarBinary(K, a, sa, b, sb, out, i, n);
+  }
+
+  template <Kind K>
+  void loop(const double* a, std::size_t sa, const double* b, std::size_t sb, double* out,
+            std::size_t n) {
+    switch (activeIsa()) {
+      case Isa::Avx2:
+        loopAvx2<K>(a, sa, b, sb, out, n);
+        break;
+      case Isa::Sse2:
+        loopSse2<K>(a, sa, b, sb, out, n);
+        break;
+      default:
+        scalarBinary(K, a, sa, b, sb, out, 0, n);
+    }
+  }
+
+  __attribute__((target("avx2"))) inline double sumAvx2(const double* a, std::size_t n) {
+    __m256d acc = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      acc = _mm256_add_pd(acc, _mm256_loadu_pd(a + i));
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, acc);
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; ++i) {
+      sum += a[i];
+    }
+    return sum;
+  }
+#else
+  template <Kind K>
+  void loop(const double* a, std::size_t sa, const double* b, std::size_t sb, double* out,
+            std::size_t n) {
+    scalarBinary(K, a, sa, b, sb, out, 0, n);
+  }
+#endif
+
+  inline void binary(Kind kind, const double* a, std::size_t sa, const double* b, std::size_t sb,
+                     double* out, std::size_t n) {
+    switch (kind) {
+      case Kind::Add:
+        return loop<Kind::Add>(a, sa, b, sb, out, n);
+      case Kind::Sub:
+        return loop<Kind::Sub>(a, sa, b, sb, out, n);
+      case Kind::Mul:
+        return loop<Kind::Mul>(a, sa, b, sb, out, n);
+      case Kind::Div:
+        return loop<Kind::Div>(a, sa, b, sb, out, n);
+      case Kind::Lt:
+        return loop<Kind::Lt>(a, sa, b, sb, out, n);
+      case Kind::Le:
+        return loop<Kind::Le>(a, sa, b, sb, out, n);
+      case Kind::Gt:
+        return loop<Kind::Gt>(a, sa, b, sb, out, n);
+      case Kind::Ge:
+        return loop<Kind::Ge>(a, sa, b, sb, out, n);
+      case Kind::Eq:
+        return loop<Kind::Eq>(a, sa, b, sb, out, n);
+      default:
+        return loop<Kind::Ne>(a, sa, b, sb, out, n);
+    }
+  }
+
+  // 向量化求和的累加顺序与逐个相加不同,结果可能差在最后几位
+  inline double sum(const double* a, std::size_t n) {
+#if REACTION_X86_SIMD
+    if (activeIsa() == Isa::Avx2) {
+      return sumAvx2(a, n);
+    }
+#endif
+    double sum = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      sum += a[i];
+    }
+    return sum;
+  }
+}  // namespace reaction::simd
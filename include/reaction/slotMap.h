@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "policy.h"
+
+namespace reaction {
+  // 句柄:槽位下标+代数,槽位被释放时代数加一,旧句柄随即失效
+  struct Handle {
+    static constexpr std::uint32_t kInvalid = UINT32_MAX;
+
+    std::uint32_t index = kInvalid;
+    std::uint32_t generation = 0;
+
+    bool valid() const { return index != kInvalid; }
+  };
+
+  // 分块存储的槽位表:扩容只追加新块,已有槽位地址不变,读取只需一次普通的原子load,
+  // 不需要加锁也没有引用计数的读改写;插入和删除走互斥锁
+  template <typename T, typename Owner>
+  class SlotMap {
+   public:
+    static constexpr std::size_t kChunkBits = 10;
+    static constexpr std::size_t kChunkSize = std::size_t{1} << kChunkBits;
+    static constexpr std::size_t kMaxChunks = 4096;
+
+    SlotMap() = default;
+    SlotMap(const SlotMap&) = delete;
+    SlotMap& operator=(const SlotMap&) = delete;
+
+    ~SlotMap() {
+      for (auto& chunk : m_chunks) {
+        delete[] chunk.load(std::memory_order_relaxed);
+      }
+    }
+
+    Handle insert(T* ptr, Owner owner) {
+      std::lock_guard<ThreadingPolicy::Mutex> lock(m_mutex);
+      std::uint32_t index = m_freeHead;
+      if (index != Handle::kInvalid) {
+        m_freeHead = slot(index).nextFree;
+      } else {
+        index = m_size++;
+        std::size_t chunk = index >> kChunkBits;
+        if (chunk >= kMaxChunks) {
+          throw std::length_error("SlotMap is full");
+        }
+        if (!m_chunks[chunk].load(std::memory_order_relaxed)) {
+          m_chunks[chunk].store(new Slot[kChunkSize], std::memory_order_release);
+        }
+      }
+      Slot& s = slot(index);
+      s.owner = std::move(owner);
+      s.ptr.store(ptr, std::memory_order_release);
+      return {index, s.generation.load(std::memory_order_relaxed)};
+    }
+
+    // 释放槽位,返回它持有的对象,由调用方在锁外析构
+    Owner erase(Handle handle) {
+      std::lock_guard<ThreadingPolicy::Mutex> lock(m_mutex);
+      return eraseLocked(handle);
+    }
+
+    // 一次加锁释放一批槽位
+    std::vector<Owner> erase(const std::vector<Handle>& handles) {
+      std::vector<Owner> owners;
+      owners.reserve(handles.size());
+      std::lock_guard<ThreadingPolicy::Mutex> lock(m_mutex);
+      for (const auto& handle : handles) {
+        owners.emplace_back(eraseLocked(handle));
+      }
+      return owners;
+    }
+
+    T* get(Handle handle) const {
+      const Slot* s = find(handle);
+      return s ? s->ptr.load(std::memory_order_acquire) : nullptr;
+    }
+
+    // 只读遍历所有存活槽位,调用方需保证期间没有并发插入删除
+    template <typename F>
+    void forEach(F&& fun) const {
+      for (std::uint32_t index = 0; index < m_size; ++index) {
+        if (T* ptr = slot(index).ptr.load(std::memory_order_acquire)) {
+          fun(ptr);
+        }
+      }
+    }
+
+   private:
+    struct Slot {
+      std::atomic<std::uint32_t> generation{0};
+      std::atomic<T*> ptr{nullptr};
+      Owner owner{};
+      std::uint32_t nextFree = Handle::kInvalid;
+    };
+
+    Owner eraseLocked(Handle handle) {
+      Slot* s = find(handle);
+      if (!s) {
+        return Owner{};
+      }
+      s->generation.fetch_add(1, std::memory_order_acq_rel);
+      s->ptr.store(nullptr, std::memory_order_relaxed);
+      s->nextFree = m_freeHead;
+      m_freeHead = handle.index;
+      return std::move(s->owner);
+    }
+
+    Slot& slot(std::uint32_t index) const {
+      return m_chunks[index >> kChunkBits].load(std::memory_order_acquire)[index & (kChunkSize - 1)];
+    }
+
+    Slot* find(Handle handle) const {
+      std::size_t chunk = handle.index >> kChunkBits;
+      if (chunk >= kMaxChunks) {
+        return nullptr;  // 包括被移动后的无效句柄
+      }
+      Slot* slots = m_chunks[chunk].load(std::memory_order_acquire);
+      if (!slots) {
+        return nullptr;
+      }
+      Slot& s = slots[handle.index & (kChunkSize - 1)];
+      if (s.generation.load(std::memory_order_acquire) != handle.generation) {
+        return nullptr;
+      }
+      return &s;
+    }
+
+    std::array<std::atomic<Slot*>, kMaxChunks> m_chunks{};
+    std::uint32_t m_size = 0;
+    std::uint32_t m_freeHead = Handle::kInvalid;
+    ThreadingPolicy::Mutex m_mutex;
+  };
+}  // namespace reaction
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "reaction/observerNode.h"
+#include "reaction/react.h"
+
+namespace reaction {
+  // 一致性快照:构造时固定图当前的epoch,通过它读到的所有节点都来自同一轮传播结束时的状态。
+  // 读取不加锁也不阻塞写线程,旧版本在所有固定了更早epoch的快照析构后才回收。
+  // 要求图以snapshots选项创建,读者持有的React句柄保证节点在读取期间存活
+  class Snapshot {
+   public:
+    explicit Snapshot(ObserverGraph& graph = Graph::instance())
+        : m_graph(&graph), m_epoch(graph.pin(m_slot)) {}
+    ~Snapshot() { m_graph->unpin(m_slot); }
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    template <typename ReactType>
+    decltype(auto) get(const React<ReactType>& react) const {
+      return react.getPtr()->versionAt(m_epoch);
+    }
+
+    std::uint64_t epoch() const { return m_epoch; }
+
+   private:
+    ObserverGraph* m_graph;
+    std::size_t m_slot = 0;
+    std::uint64_t m_epoch;
+  };
+}  // namespace reaction
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace reaction {
+  // 工作窃取线程池:每个工作线程有自己的双端队列,自己从尾部取,空闲时从别人头部偷
+  class ThreadPool {
+   public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(std::size_t threads = std::max(1u, std::thread::hardware_concurrency()))
+        : m_pending(0) {
+      threads = std::max<std::size_t>(threads, 1);
+      for (std::size_t i = 0; i < threads; ++i) {
+        m_queues.emplace_back(std::make_unique<WorkQueue>());
+      }
+      for (std::size_t i = 0; i < threads; ++i) {
+        m_threads.emplace_back([this, i]() { workerLoop(i); });
+      }
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_cv.notify_all();
+      for (auto& thread : m_threads) {
+        thread.join();
+      }
+    }
+
+    std::size_t size() const { return m_threads.size(); }
+
+    template <typename F>
+    void submit(F&& task) {
+      // 工作线程提交的任务放进自己的队列,外部线程轮流分发
+      std::size_t index = t_pool == this ? t_index : m_next++ % m_queues.size();
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_pending;  // 先计数再入队,避免任务被偷走后计数下溢
+      }
+      {
+        std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+        m_queues[index]->tasks.emplace_back(std::forward<F>(task));
+      }
+      m_cv.notify_one();
+    }
+
+    // 对[0, count)并行调用fun(i),调用线程也参与执行,全部完成后返回(屏障)
+    template <typename F>
+    void parallelFor(std::size_t count, F&& fun) {
+      if (count == 0) {
+        return;
+      }
+      std::size_t step = (count + m_queues.size() * 4 - 1) / (m_queues.size() * 4);
+      std::atomic<std::size_t> remaining{(count + step - 1) / step};
+      std::exception_ptr error;
+      std::mutex errorMutex;
+
+      for (std::size_t begin = 0; begin < count; begin += step) {
+        std::size_t end = std::min(begin + step, count);
+        submit([&, begin, end]() {
+          try {
+            for (std::size_t i = begin; i < end; ++i) {
+              fun(i);
+            }
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) {
+              error = std::current_exception();
+            }
+          }
+          remaining.fetch_sub(1, std::memory_order_acq_rel);
+        });
+      }
+
+      Task task;
+      while (remaining.load(std::memory_order_acquire) > 0) {
+        if (tryPop(t_pool == this ? t_index : 0, task)) {
+          task();  // 等待期间帮忙干活,嵌套调用也不会死锁
+        } else {
+          std::this_thread::yield();
+        }
+      }
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+
+   private:
+    struct WorkQueue {
+      std::mutex mutex;
+      std::deque<Task> tasks;
+    };
+
+    bool tryPop(std::size_t index, Task& task) {
+      for (std::size_t i = 0; i < m_queues.size(); ++i) {
+        auto& queue = *m_queues[(index + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+          continue;
+        }
+        if (i == 0) {
+          task = std::move(queue.tasks.back());  // 自己的队列LIFO,缓存更热
+          queue.tasks.pop_back();
+        } else {
+          task = std::move(queue.tasks.front());  // 偷别人最老的任务
+          queue.tasks.pop_front();
+        }
+        std::lock_guard<std::mutex> pendingLock(m_mutex);
+        --m_pending;
+        return true;
+      }
+      return false;
+    }
+
+    void workerLoop(std::size_t index) {
+      t_pool = this;
+      t_index = index;
+      Task task;
+      while (true) {
+        if (tryPop(index, task)) {
+          task();
+          continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return m_stop || m_pending > 0; });
+        if (m_stop && m_pending == 0) {
+          return;
+        }
+      }
+    }
+
+    inline static thread_local ThreadPool* t_pool = nullptr;
+    inline static thread_local std::size_t t_index = 0;
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::size_t m_pending;
+    std::atomic<std::size_t> m_next{0};
+    bool m_stop = false;
+  };
+}  // namespace reaction
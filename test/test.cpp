@@ -1,8 +1,21 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #include "reaction/react.h"
+#include "reaction/snapshot.h"
 
 TEST(ReactionTest, TestCommonUse) {
   auto a = reaction::var(1);
@@ -107,6 +120,1127 @@ TEST(ReactionTest, TestExpr) {
   ASSERT_FLOAT_EQ(expr_ds.get(), -3.86);
 }
 
+TEST(ReactionTest, TestDiamond) {
+  auto a = reaction::var(1);
+  auto ds = reaction::calc([](int aa) { return aa * 2; }, a);
+  int count = 0;
+  auto dds = reaction::calc(
+      [&](int aa, int dsds) {
+        ++count;
+        EXPECT_EQ(dsds, aa * 2);  // 不应看到只更新了一半的输入
+        return aa + dsds;
+      },
+      a, ds);
+
+  count = 0;
+  a.value(2);
+  EXPECT_EQ(count, 1);
+  EXPECT_EQ(dds.get(), 6);
+}
+
+TEST(ReactionTest, TestBatch) {
+  auto a = reaction::var(1);
+  auto b = reaction::var(2);
+  int count = 0;
+  auto ds = reaction::calc(
+      [&](int aa, int bb) {
+        ++count;
+        return aa + bb;
+      },
+      a, b);
+
+  count = 0;
+  reaction::batch([&]() {
+    a.value(10);
+    b.value(20);
+    a.value(30);
+    EXPECT_EQ(count, 0);
+  });
+  EXPECT_EQ(count, 1);
+  EXPECT_EQ(ds.get(), 50);
+}
+
+TEST(ReactionTest, TestTrigger) {
+  auto a = reaction::var(1);
+  auto clamp = reaction::calc([](int aa) { return aa > 10 ? 10 : aa; }, a);
+  clamp.trigger(reaction::ChangeTrig{});
+  int count = 0;
+  auto ds = reaction::calc(
+      [&](int cc) {
+        ++count;
+        return cc * 2;
+      },
+      clamp);
+
+  count = 0;
+  a.value(20);
+  a.value(30);  // clamp仍为10,下游被剪掉
+  EXPECT_EQ(count, 1);
+  EXPECT_EQ(ds.get(), 20);
+
+  auto b = reaction::var(1.0);
+  b.trigger(reaction::ApproxEqual{1e-6});
+  auto dds = reaction::calc(
+      [&](double bb) {
+        ++count;
+        return bb;
+      },
+      b);
+  count = 0;
+  b.value(1.0 + 1e-9);
+  EXPECT_EQ(count, 0);
+  b.value(2.0);
+  EXPECT_EQ(count, 1);
+}
+
+TEST(ReactionTest, TestLazy) {
+  auto a = reaction::var(1);
+  int count = 0;
+  auto ds = reaction::lazyCalc(
+      [&](int aa) {
+        ++count;
+        return aa * 2;
+      },
+      a);
+  auto dds = reaction::lazyCalc([&](int dsds) { return dsds + 1; }, ds);
+  EXPECT_EQ(count, 0);
+
+  a.value(2);
+  a.value(3);
+  EXPECT_EQ(count, 0);
+  EXPECT_EQ(dds.get(), 7);
+  EXPECT_EQ(count, 1);
+  EXPECT_EQ(ds.get(), 6);
+  EXPECT_EQ(count, 1);
+
+  auto eager = reaction::calc([](int dsds) { return dsds; }, ds);  // 非惰性的下游会主动拉取
+  a.value(4);
+  EXPECT_EQ(eager.get(), 8);
+  EXPECT_EQ(count, 2);
+}
+
+#ifndef REACTION_SINGLE_THREAD  // 单线程策略不能并行计算
+TEST(ReactionTest, TestParallel) {
+  reaction::ThreadPool pool(4);
+  std::atomic<int> sum{0};
+  pool.parallelFor(100, [&](std::size_t i) { sum += static_cast<int>(i); });
+  EXPECT_EQ(sum.load(), 4950);
+
+  auto a = reaction::var(1);
+  auto identity = [](int aa) { return aa; };
+  std::vector<decltype(reaction::calc(identity, a))> nodes;
+  for (int i = 0; i < 200; ++i) {
+    nodes.push_back(reaction::calc(identity, a));
+  }
+  std::atomic<int> count{0};
+  auto total = reaction::calc([&]() {
+    ++count;
+    int res = 0;
+    for (auto& node : nodes) {
+      res += node();
+    }
+    return res;
+  });
+
+  auto& scheduler = reaction::Graph::instance().scheduler();
+  scheduler.enableParallel(pool, 16);
+  count = 0;
+  a.value(3);
+  scheduler.disableParallel();
+  EXPECT_EQ(total.get(), 600);
+  EXPECT_EQ(count.load(), 1);
+
+  // 同层节点共用的惰性数据源只算一次
+  int pulls = 0;
+  auto lazy = reaction::lazyCalc(
+      [&](int aa) {
+        ++pulls;
+        return aa + 1;
+      },
+      a);
+  std::vector<decltype(reaction::calc(identity, lazy))> readers;
+  for (int i = 0; i < 64; ++i) {
+    readers.push_back(reaction::calc(identity, lazy));
+  }
+  scheduler.enableParallel(pool, 16);
+  pulls = 0;
+  a.value(5);
+  scheduler.disableParallel();
+  EXPECT_EQ(pulls, 1);
+  EXPECT_EQ(readers.back().get(), 6);
+
+  // 并发写入模式下写线程的调度器也按层并行
+  reaction::Graph g({.concurrentWrites = true});
+  auto x = g.var(1);
+  std::atomic<int> evaluated{0};
+  auto countAdd = [&](int xx) {
+    ++evaluated;
+    return xx + 1;
+  };
+  std::vector<decltype(g.calc(countAdd, x))> fanout;
+  for (int i = 0; i < 64; ++i) {
+    fanout.push_back(g.calc(countAdd, x));
+  }
+  g.scheduler().enableParallel(pool, 16);
+  evaluated = 0;
+  x.value(2);
+  g.scheduler().disableParallel();
+  EXPECT_EQ(evaluated.load(), 64);
+  EXPECT_EQ(fanout.front().get(), 3);
+}
+#endif
+
+TEST(ReactionTest, TestDuplicateDependency) {
+  auto a = reaction::var(1);
+  int count = 0;
+  auto ds = reaction::calc([&]() {
+    ++count;
+    return a() + a() * a();
+  });
+
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 1);
+  count = 0;
+  a.value(2);
+  EXPECT_EQ(count, 1);
+  EXPECT_EQ(ds.get(), 6);
+
+  auto dds = reaction::calc([&](int aa, int bb) { return aa + bb; }, a, a);
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 2);
+  a.value(3);
+  EXPECT_EQ(count, 2);
+  EXPECT_EQ(dds.get(), 6);
+
+  // 嵌套拉取的惰性节点也读a,外层随后再读a仍只订阅一次
+  auto lazy = reaction::lazyCalc([&]() { return a() * 10; });
+  auto outer = reaction::calc([&]() { return a() + lazy() + a(); });
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 4);
+  a.value(4);
+  EXPECT_EQ(outer.get(), 48);
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 4);
+}
+
+TEST(ReactionTest, TestDynamicDependency) {
+  auto flag = reaction::var(true);
+  auto a = reaction::var(1);
+  auto b = reaction::var(2);
+  int count = 0;
+  auto ds = reaction::calc([&]() {
+    ++count;
+    return flag() ? a() : b();
+  });
+  EXPECT_EQ(b.getSharedPtr()->observerCount(), 0);
+
+  count = 0;
+  b.value(3);  // 未走到的分支不触发
+  EXPECT_EQ(count, 0);
+
+  flag.value(false);
+  EXPECT_EQ(ds.get(), 3);
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 0);
+  EXPECT_EQ(b.getSharedPtr()->observerCount(), 1);
+
+  count = 0;
+  a.value(5);
+  EXPECT_EQ(count, 0);
+  b.value(4);  // 后来才走到的分支也能触发
+  EXPECT_EQ(count, 1);
+  EXPECT_EQ(ds.get(), 4);
+}
+
+TEST(ReactionTest, TestValueStorage) {
+  auto a = reaction::var(1);
+  auto big = reaction::var(std::array<double, 64>{});
+  auto ds = reaction::calc([](int aa, const std::array<double, 64>& bb) { return aa + bb[0]; },
+                           a, big);
+  EXPECT_EQ(a.getSharedPtr()->getRawPtr(), &a.get());  // 小对象内联存储,地址稳定
+  static_assert(sizeof(reaction::ValueStorage<int>) < sizeof(int) + 2 * sizeof(void*));
+  static_assert(sizeof(reaction::ValueStorage<std::array<double, 64>>) == sizeof(void*));
+
+  big.value(std::array<double, 64>{2.5});
+  EXPECT_EQ(ds.get(), 3.5);
+  EXPECT_EQ(big->at(0), 2.5);
+}
+
+TEST(ReactionTest, TestNodePool) {
+  reaction::Graph g;
+  constexpr std::size_t kAlign = reaction::NodePool::kAlign;
+  constexpr auto kBlock =
+      static_cast<std::ptrdiff_t>((sizeof(reaction::ReactImpl<int>) + kAlign - 1) / kAlign * kAlign);
+  const reaction::ObserverNode* freed = nullptr;
+  {
+    auto a = g.var(1);
+    auto b = g.var(2);
+    EXPECT_EQ(reinterpret_cast<const char*>(b.getSharedPtr().get()) -
+                  reinterpret_cast<const char*>(a.getSharedPtr().get()),
+              kBlock);  // 同级的节点从同一大块里连续切出
+    freed = a.getSharedPtr().get();
+  }
+  auto c = g.var(3);  // 最后释放的a的块被复用
+  EXPECT_EQ(c.getSharedPtr().get(), freed);
+
+  auto ds = g.calc([](int cc) { return cc + 1; }, c);
+  c.value(4);
+  EXPECT_EQ(ds.get(), 5);
+}
+
+TEST(ReactionTest, TestRegion) {
+  auto a = reaction::var(1);
+  int count = 0;
+  {
+    reaction::Region region;
+    auto b = reaction::var(2);
+    auto ds = reaction::calc([&]() {
+      ++count;
+      return a() + b();
+    });
+    auto dds = reaction::calc([](int dsds) { return dsds * 2; }, ds);
+    EXPECT_EQ(region.size(), 3);
+
+    a.value(2);
+    EXPECT_EQ(dds.get(), 8);
+    EXPECT_EQ(a.getSharedPtr()->observerCount(), 1);
+  }
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 0);  // 区域释放后不再通知已死的节点
+
+  count = 0;
+  a.value(3);
+  EXPECT_EQ(count, 0);
+
+  // 区域里的节点可以属于不同的图,并发写入模式下也一起释放
+#ifdef REACTION_SINGLE_THREAD
+  reaction::Graph g;
+#else
+  reaction::Graph g({.concurrentWrites = true});
+#endif
+  auto c = g.var(1);
+  std::optional<decltype(g.var(0))> inner;
+  std::optional<decltype(reaction::var(0))> outer;
+  {
+    reaction::Region region;
+    inner.emplace(g.var(2));
+    outer.emplace(reaction::var(3));
+    auto sum = g.calc([](int cc, int ii) { return cc + ii; }, c, *inner);
+    EXPECT_EQ(sum.get(), 3);
+    EXPECT_EQ(c.getSharedPtr()->observerCount(), 1);
+  }
+  EXPECT_FALSE(*inner);
+  EXPECT_FALSE(*outer);
+  EXPECT_EQ(c.getSharedPtr()->observerCount(), 0);
+}
+
+TEST(ReactionTest, TestHandle) {
+  static_assert(sizeof(reaction::React<reaction::ReactImpl<int>>) == sizeof(void*) + sizeof(reaction::Handle));
+  std::optional<reaction::React<reaction::ReactImpl<int>>> a;
+  {
+    reaction::Region region;
+    a = reaction::var(1);
+    auto copy = *a;
+    EXPECT_EQ(copy.get(), 1);
+    EXPECT_TRUE(static_cast<bool>(*a));
+  }
+  EXPECT_FALSE(static_cast<bool>(*a));  // 槽位代数变了,旧句柄失效
+  EXPECT_THROW(a->get(), std::runtime_error);
+
+  auto b = reaction::var(2);  // 复用释放的槽位,旧句柄依然无效
+  EXPECT_FALSE(static_cast<bool>(*a));
+  EXPECT_EQ(b.get(), 2);
+}
+
+TEST(ReactionTest, TestRefCount) {
+  reaction::RefCount<reaction::SingleThread> count;
+  count.increment();
+  count.increment();
+  EXPECT_EQ(count.decrement(), 1);
+  static_assert(sizeof(reaction::RefCount<reaction::SingleThread>) == sizeof(std::uint32_t));
+
+  reaction::NodeRef<reaction::ReactImpl<int>> ref;
+  {
+    auto a = reaction::var(1);
+    std::vector<decltype(a)> copies(100, a);  // 拷贝句柄只是计数加一
+    EXPECT_EQ(copies.back().get(), 1);
+    ref = a.getSharedPtr();
+  }
+  EXPECT_EQ(ref->get(), 1);  // 句柄都没了,但仍被侵入式指针持有
+}
+
+TEST(ReactionTest, TestGraph) {
+  reaction::Graph g1;
+  reaction::Graph g2;
+  auto a = g1.var(1);
+  auto b = g2.var(1);
+  auto da = g1.calc([](int x) { return x * 10; }, a);
+  auto db = g2.calc([](int x) { return x * 10; }, b);
+  EXPECT_EQ(a.graph(), &g1);
+  EXPECT_EQ(db.graph(), &g2);
+
+  g1.batch([&] {
+    a.value(2);
+    b.value(2);  // 另一张图不受这张图批量更新的影响,立即传播
+    EXPECT_EQ(da.get(), 10);
+    EXPECT_EQ(db.get(), 20);
+  });
+  EXPECT_EQ(da.get(), 20);
+
+  auto c = reaction::var(3);  // 默认图
+  EXPECT_EQ(c.graph(), &reaction::Graph::instance());
+
+  EXPECT_THROW(g2.calc([](int x) { return x; }, a), std::logic_error);  // 不能依赖别的图
+  EXPECT_THROW(g2.calc([&]() { return a() + b(); }), std::logic_error);
+  EXPECT_THROW(g2.expr(a + b), std::logic_error);
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 1);
+}
+
+#ifndef REACTION_SINGLE_THREAD  // 单线程策略下条带锁是空锁
+TEST(ReactionTest, TestConcurrentWriters) {
+  reaction::Graph g({.concurrentWrites = true});
+  constexpr int kThreads = 4;
+  constexpr int kWrites = 2000;
+  std::vector<reaction::React<reaction::ReactImpl<int>>> sources;
+  for (int i = 0; i < kThreads; ++i) {
+    sources.push_back(g.var(0));
+  }
+  auto add = [](int aa, int bb) { return aa + bb; };
+  std::vector<decltype(g.calc(add, sources[0], sources[1]))> sums;
+  for (int i = 0; i < kThreads; i += 2) {
+    sums.push_back(g.calc(add, sources[i], sources[i + 1]));  // 两个线程一组写同一个分量
+  }
+
+  std::vector<std::thread> writers;
+  for (int i = 0; i < kThreads; ++i) {
+    writers.emplace_back([&, i] {
+      for (int n = 1; n <= kWrites; ++n) {
+        sources[i].value(n);
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  for (auto& sum : sums) {
+    EXPECT_EQ(sum.get(), 2 * kWrites);
+  }
+
+  // action写另一个分量的var时推迟到本轮传播结束后执行
+  auto other = g.var(0);
+  auto mirror = g.action([&](int x) { other.value(x); }, sources[0]);
+  sources[0].value(7);
+  EXPECT_EQ(other.get(), 7);
+}
+
+TEST(ReactionTest, TestConcurrentCrossComponent) {
+  reaction::Graph g({.concurrentWrites = true});
+  auto x = g.var(0);
+  auto y = g.var(5);
+  auto pick = g.calc([&]() { return x() > 0 ? y() : 0; });
+  // 传播中只锁了x所在的分量,新读到y时升级成独占整张图,合并分量后重算
+  x.value(1);
+  EXPECT_EQ(pick.get(), 5);
+  EXPECT_EQ(y.getSharedPtr()->observerCount(), 1);
+  y.value(6);
+  EXPECT_EQ(pick.get(), 6);
+
+  // 两个写线程各自的分量在传播中被合并,最后的值与写入顺序无关
+  auto a = g.var(0);
+  auto b = g.var(0);
+  auto c = g.var(0);
+  auto gate = g.calc([&]() { return a() > 0 ? b() + c() : -1; });
+  auto sum = g.calc([&]() { return b() + c(); });
+  std::thread writer([&] {
+    for (int i = 1; i <= 200; ++i) {
+      c.value(i);
+    }
+  });
+  a.value(1);
+  for (int i = 1; i <= 200; ++i) {
+    b.value(i);
+  }
+  writer.join();
+  EXPECT_EQ(gate.get(), 400);
+  EXPECT_EQ(sum.get(), 400);
+
+  // 传播中抛异常时,本轮推迟的跨分量写入一起丢弃,不会在本线程之后的写入里冒出来
+  auto other = g.var(0);
+  auto trigger = g.var(0);
+  auto failing = g.calc(
+      [&](int t) {
+        if (t > 0) {
+          other.value(t);
+          throw std::runtime_error("failed");
+        }
+        return t;
+      },
+      trigger);
+  EXPECT_THROW(trigger.value(1), std::runtime_error);
+  x.value(3);
+  EXPECT_EQ(other.get(), 0);
+}
+#else
+TEST(ReactionTest, TestSingleThreadPolicy) {
+  // 空锁和非原子计数下并发会静默出错,直接拒绝
+  EXPECT_THROW(reaction::Graph({.concurrentWrites = true}), std::logic_error);
+  reaction::ThreadPool pool(2);
+  EXPECT_THROW(reaction::Graph::instance().scheduler().enableParallel(pool), std::logic_error);
+}
+#endif
+
+TEST(ReactionTest, TestSnapshot) {
+  reaction::Graph g({.snapshots = true});
+  auto a = g.var(1);
+  auto b = g.calc([](int aa) { return aa * 2; }, a);
+  std::optional<reaction::Snapshot> before(std::in_place, g);
+  a.value(2);
+  reaction::Snapshot after(g);
+  EXPECT_EQ(before->get(a), 1);
+  EXPECT_EQ(before->get(b), 2);
+  EXPECT_EQ(after.get(a), 2);
+  EXPECT_EQ(after.get(b), 4);
+  EXPECT_GT(after.epoch(), before->epoch());
+  before.reset();
+
+  auto c = g.var(5);  // 快照之后创建的节点读到初始值
+  EXPECT_EQ(after.get(c), 5);
+
+#ifndef REACTION_SINGLE_THREAD
+  std::atomic<bool> done{false};
+  std::thread reader([&] {
+    while (!done.load()) {
+      reaction::Snapshot snapshot(g);
+      EXPECT_EQ(snapshot.get(b), snapshot.get(a) * 2);  // 不会看到一半新一半旧
+    }
+  });
+  for (int i = 0; i < 10000; ++i) {
+    a.value(i);
+  }
+  done = true;
+  reader.join();
+#endif
+}
+
+TEST(ReactionTest, TestSnapshotVersions) {
+  reaction::Graph g({.snapshots = true});
+  auto a = g.var(1);
+  auto lazy = g.lazyCalc([](int aa) { return aa * 10; }, a);
+  {
+    reaction::Snapshot first(g);
+    EXPECT_EQ(first.get(lazy), 10);  // 没有被读过的惰性节点也有版本
+    a.value(2);
+    reaction::Snapshot second(g);
+    EXPECT_EQ(second.get(a), 2);
+    EXPECT_EQ(second.get(lazy), 20);
+    EXPECT_EQ(first.get(lazy), 10);
+  }
+  {
+    reaction::Snapshot pinned(g);
+    a.value(3);
+    a.value(4);
+    EXPECT_EQ(pinned.get(lazy), 20);
+    EXPECT_EQ(a.getPtr()->versionCount(), 3);
+  }
+  // 之后不再变化的节点,旧版本在读者释放时回收
+  EXPECT_EQ(a.getPtr()->versionCount(), 1);
+  EXPECT_EQ(lazy.getPtr()->versionCount(), 1);
+}
+
+TEST(ReactionTest, TestExprFused) {
+  auto a = reaction::var(2);
+  auto b = reaction::var(3);
+  auto ds = reaction::expr(a * a + b);
+  EXPECT_EQ(ds.get(), 7);
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 1);  // 同一个叶子只订阅一次
+  EXPECT_FALSE(ds.getSharedPtr()->dynamic());        // 不再靠()在计算时收集依赖
+
+  auto dds = reaction::expr(ds * 2 - b);
+  auto source = b.getSharedPtr();
+  b = reaction::var(0);  // 换掉句柄,表达式仍然持有原来的节点
+  source->value(4);
+  EXPECT_EQ(ds.get(), 8);
+  EXPECT_EQ(dds.get(), 12);
+}
+
+TEST(ReactionTest, TestExprOperators) {
+  auto a = reaction::var(7);
+  auto b = reaction::var(-2.5);
+  auto lt = reaction::expr(a < 10);
+  auto both = reaction::expr((a > 0) && (b < 0));
+  auto clamp = reaction::expr(reaction::select(a > 5, reaction::min(a, 6), -a));
+  auto mod = reaction::expr(a % 4);
+  auto mag = reaction::expr(reaction::sqrt(reaction::abs(b) * 10) + reaction::max(a, b));
+  EXPECT_TRUE(lt.get());
+  EXPECT_TRUE(both.get());
+  EXPECT_EQ(clamp.get(), 6);
+  EXPECT_EQ(mod.get(), 3);
+  EXPECT_DOUBLE_EQ(mag.get(), 12.0);
+
+  a.value(3);
+  EXPECT_FALSE(!lt.get());
+  EXPECT_EQ(clamp.get(), -3);
+  EXPECT_EQ(mod.get(), 3);
+  auto notBoth = reaction::expr(!(a == 3) || (b != -2.5));
+  EXPECT_FALSE(notBoth.get());
+}
+
+TEST(ReactionTest, TestConstantFolding) {
+  auto c1 = reaction::constVar(2);
+  auto c2 = reaction::constVar(3);
+  auto folded = c1 * c2;  // 全是常量,构造时就算出来
+  static_assert(std::is_same_v<decltype(folded), reaction::ValueWrapper<int>>);
+  EXPECT_EQ(folded + 1, 7);  // 折叠后就是普通数值
+
+  auto a = reaction::var(1);
+  auto ds = reaction::expr(a * (c1 * c2));  // 子树折叠成一个常量操作数
+  static_assert(std::is_same_v<decltype(a * (c1 * c2)),
+                               reaction::OpExpr<reaction::MulOp, decltype(a),
+                                                reaction::ValueWrapper<int>>>);
+  a.value(2);
+  EXPECT_EQ(ds.get(), 12);
+
+  auto whole = reaction::expr(c1 + c2);
+  EXPECT_EQ(whole.get(), 5);
+  EXPECT_EQ(c1.getSharedPtr()->observerCount(), 0);  // 不订阅常量
+}
+
+TEST(ReactionTest, TestArray) {
+  using Vec = reaction::Array<double>;
+  constexpr std::size_t kSize = 1003;  // 不是4的倍数,覆盖尾部的标量处理
+  Vec x(kSize), y(kSize);
+  for (std::size_t i = 0; i < kSize; ++i) {
+    x[i] = static_cast<double>(i);
+    y[i] = static_cast<double>(kSize - i);
+  }
+  auto a = reaction::var(x);
+  auto b = reaction::var(y);
+  auto ds = reaction::expr((a + b) * 2.0 - a / b);
+  auto mask = reaction::expr(a < b);
+  auto total = reaction::expr(reaction::sum(a * b));
+  auto peak = reaction::expr(reaction::maxElement(reaction::select(a > b, a, -b)));
+
+  auto check = [&] {
+    const Vec& av = a.get();
+    const Vec& bv = b.get();
+    double expectTotal = 0;
+    double expectPeak = -1e300;
+    for (std::size_t i = 0; i < kSize; ++i) {
+      EXPECT_DOUBLE_EQ(ds.get()[i], (av[i] + bv[i]) * 2.0 - av[i] / bv[i]);
+      EXPECT_EQ(mask.get()[i], av[i] < bv[i] ? 1.0 : 0.0);
+      expectTotal += av[i] * bv[i];
+      expectPeak = std::max(expectPeak, av[i] > bv[i] ? av[i] : -bv[i]);
+    }
+    EXPECT_NEAR(total.get(), expectTotal, 1e-6 * expectTotal);
+    EXPECT_EQ(peak.get(), expectPeak);
+  };
+  check();
+
+  const double* buffer = ds.get().data();
+  x[0] = 100;
+  a.value(x);
+  check();
+  EXPECT_EQ(ds.get().data(), buffer);  // 结果写进原来的缓冲区
+
+  auto& isa = reaction::simd::activeIsa();
+  auto saved = isa;
+  isa = reaction::simd::Isa::Scalar;  // 标量回退的结果一致
+  b.value(x);
+  check();
+  isa = reaction::simd::Isa::Sse2;
+  a.value(y);
+  check();
+  isa = saved;
+
+  EXPECT_THROW(b.value(Vec(3)), std::invalid_argument);
+}
+
+TEST(ReactionTest, TestReactiveCollection) {
+  auto prices = reaction::reactiveVector(std::vector<int>{5, 1, 4});
+  static_assert(std::is_same_v<decltype(prices.get()), const std::vector<int>&>);  // 只能经日志修改
+  int calls = 0;
+  auto doubled = reaction::mapped(prices, [&](int x) {
+    ++calls;
+    return x * 2;
+  });
+  auto odd = reaction::filtered(prices, [](int x) { return x % 2 == 1; });
+  auto order = reaction::sorted(prices);
+  auto total = reaction::calc(
+      [](const std::vector<int>& values) {
+        int sum = 0;
+        for (int v : values) {
+          sum += v;
+        }
+        return sum;
+      },
+      doubled);
+  EXPECT_EQ(total.get(), 20);
+
+  calls = 0;
+  prices->set(1, 3);  // 只重算变化的元素
+  prices->push_back(2);
+  prices->erase(0);
+  EXPECT_EQ(calls, 2);
+  EXPECT_EQ(prices.get(), (std::vector<int>{3, 4, 2}));
+  EXPECT_EQ(doubled.get(), (std::vector<int>{6, 8, 4}));
+  EXPECT_EQ(odd.get(), (std::vector<int>{3}));
+  EXPECT_EQ(order.get(), (std::vector<int>{2, 3, 4}));
+  EXPECT_EQ(total.get(), 18);
+
+  prices.value(std::vector<int>{7, 4});  // 整体替换也按差异传播
+  EXPECT_EQ(calls, 3);
+  EXPECT_EQ(odd.get(), (std::vector<int>{7}));
+  EXPECT_EQ(order.get(), (std::vector<int>{4, 7}));
+  EXPECT_EQ(prices.getSharedPtr()->logSize(), 2);  // 下游读过的旧变化已经丢弃,只剩最近一次的
+
+  // 订单簿:价格到数量,按数量排序、按档位分组
+  auto book = reaction::reactiveMap(std::map<int, int>{{100, 5}, {101, 7}, {102, 1}});
+  static_assert(std::is_same_v<decltype(book.get()), const std::map<int, int>&>);
+  auto large = reaction::filtered(book, [](int qty) { return qty >= 5; });
+  auto byQty = reaction::sorted(book, std::greater<>{});
+  auto bands = reaction::groupBy(book, [](int qty) { return qty / 5; });
+  auto scaled = reaction::mapped(bands, [](int qty) { return qty * 10; });
+  reaction::batch([&] {
+    book->set(102, 9);
+    book->erase(100);
+    book->set(103, 2);
+  });
+  EXPECT_EQ(large.get(), (std::map<int, int>{{101, 7}, {102, 9}}));
+  EXPECT_EQ(byQty.get(), (std::vector<std::pair<int, int>>{{102, 9}, {101, 7}, {103, 2}}));
+  EXPECT_EQ(bands.get(), (std::map<int, std::map<int, int>>{{0, {{103, 2}}}, {1, {{101, 7}, {102, 9}}}}));
+  EXPECT_EQ(scaled.get().at({1, 102}), 90);
+  EXPECT_EQ(scaled.get().size(), 3);
+  EXPECT_THROW(prices->erase(5), std::out_of_range);
+}
+
+TEST(ReactionTest, TestFilteredRank) {
+  std::vector<int> init(64);
+  for (int i = 0; i < 64; ++i) {
+    init[i] = i;
+  }
+  auto list = reaction::reactiveVector(init);
+  auto even = reaction::filtered(list, [](int x) { return x % 2 == 0; });
+  auto expect = [&] {
+    std::vector<int> kept;
+    for (int x : list.get()) {
+      if (x % 2 == 0) {
+        kept.push_back(x);
+      }
+    }
+    return kept;
+  };
+
+  std::mt19937 rng(7);
+  for (int step = 0; step < 500; ++step) {  // 在中间交替插入、删除和修改,每步都核对名次
+    std::size_t size = list.get().size();
+    std::size_t index = size ? rng() % size : 0;
+    switch (rng() % 3) {
+      case 0:
+        list->insert(index, static_cast<int>(rng() % 100));
+        break;
+      case 1:
+        if (size) {
+          list->erase(index);
+        }
+        break;
+      default:
+        if (size) {
+          list->set(index, static_cast<int>(rng() % 100));
+        }
+        break;
+    }
+    ASSERT_EQ(even.get(), expect()) << "step " << step;
+  }
+}
+
+TEST(ReactionTest, TestRelational) {
+  struct Order {
+    int account;
+    int qty;
+    bool operator==(const Order&) const = default;
+  };
+  auto orders = reaction::reactiveMap(std::map<int, Order>{{1, {10, 5}}, {2, {10, 3}}, {3, {20, 4}}});
+  auto owners = reaction::reactiveMap(std::map<int, std::string>{{10, "ann"}, {20, "bob"}});
+  auto byAccount = [](const Order& o) { return o.account; };
+  auto qty = [](const Order& o) { return o.qty; };
+  auto named = reaction::join(orders, owners, byAccount, [](int id, const std::string&) { return id; });
+  auto none = reaction::join(orders, reaction::mapped(owners, [](const std::string& s) { return s.size(); }),
+                             qty, [](std::size_t len) { return static_cast<int>(len) * 100; });
+  auto total = reaction::aggregate(orders, byAccount, reaction::Sum{qty});
+  auto count = reaction::aggregate(orders, byAccount, reaction::Count{});
+  auto smallest = reaction::aggregate(orders, byAccount, reaction::Min{qty});
+  auto largest = reaction::aggregate(orders, byAccount, reaction::Max{qty});
+  EXPECT_TRUE(none.get().empty());
+  EXPECT_EQ(named.get().size(), 3);
+  EXPECT_EQ(total.get(), (std::map<int, int>{{10, 8}, {20, 4}}));
+
+  int evaluations = 0;
+  auto watch = reaction::calc(
+      [&](const std::map<int, int>& t) {
+        ++evaluations;
+        return t.size();
+      },
+      total);
+  evaluations = 0;
+  reaction::batch([&] {
+    orders->set(2, {20, 3});  // 换到另一个组
+    orders->set(4, {10, 9});
+    owners->set(30, "cat");  // 没有匹配的订单
+  });
+  EXPECT_EQ(evaluations, 1);
+  EXPECT_EQ(total.get(), (std::map<int, int>{{10, 14}, {20, 7}}));
+  EXPECT_EQ(count.get(), (std::map<int, std::size_t>{{10, 2}, {20, 2}}));
+  EXPECT_EQ(smallest.get(), (std::map<int, int>{{10, 5}, {20, 3}}));
+  EXPECT_EQ(largest.get(), (std::map<int, int>{{10, 9}, {20, 4}}));
+  EXPECT_EQ(named.get().at({2, 20}).second, "bob");
+  EXPECT_EQ(named.get().size(), 4);
+
+  orders->erase(3);
+  owners->set(20, "bea");
+  EXPECT_EQ(largest.get().at(20), 3);
+  EXPECT_EQ(named.get().at({2, 20}).second, "bea");
+  orders->erase(2);  // 组里的元素删光,组随之消失
+  EXPECT_EQ(total.get(), (std::map<int, int>{{10, 14}}));
+  EXPECT_EQ(named.get().size(), 2);
+}
+
+TEST(ReactionTest, TestInlineFunction) {
+  using Fun = reaction::InlineFunction<int()>;
+  auto owned = std::make_unique<int>(5);
+  Fun small([p = std::move(owned)] { return *p; });  // 只能移动的捕获也可以
+  static_assert(Fun::kInline<std::array<char, 64>>);
+  static_assert(!Fun::kInline<std::array<char, 65>>);
+  Fun moved = std::move(small);
+  EXPECT_FALSE(static_cast<bool>(small));
+  EXPECT_EQ(moved(), 5);
+
+  std::array<int, 32> big{};
+  big[31] = 7;
+  Fun heap([big] { return big[31]; });  // 放不下的对象放到堆上
+  moved = std::move(heap);
+  EXPECT_EQ(moved(), 7);
+
+  auto a = reaction::var(1);
+  auto ds = reaction::calc([p = std::make_unique<int>(10)](int aa) { return aa + *p; }, a);
+  a.value(2);
+  EXPECT_EQ(ds.get(), 12);
+  ds.reset([](int aa) { return aa * 3; }, a);  // 换成别的函数类型
+  a.value(3);
+  EXPECT_EQ(ds.get(), 9);
+}
+
+TEST(ReactionTest, TestZeroCopy) {
+  auto text = reaction::var(std::string(1 << 20, 'x'));
+  const std::string* seen = nullptr;
+  auto length = reaction::calc(
+      [&](const std::string& s) {
+        seen = &s;  // 直接引用节点里的值
+        return s.size();
+      },
+      text);
+  EXPECT_EQ(seen, &text.get());
+
+  using Blob = reaction::Immutable<std::vector<int>>;
+  auto blob = reaction::var(Blob(std::vector<int>(1 << 18, 1)));
+  const int* data = blob.get()->data();
+  auto shares = [data](Blob b) { return b->data() == data ? 1 : 0; };
+  std::vector<decltype(reaction::calc(shares, blob))> readers;
+  for (int i = 0; i < 200; ++i) {
+    readers.push_back(reaction::calc(shares, blob));
+  }
+  EXPECT_EQ(readers.back().get(), 1);  // 按值接收也只是计数加一
+
+  Blob next = blob.get();
+  next.mutate()[0] = 2;  // 与节点共享时先复制一份
+  EXPECT_EQ(blob.get()->at(0), 1);
+  blob.value(std::move(next));
+  EXPECT_EQ(readers.front().get(), 0);
+  EXPECT_EQ(blob.get()->at(0), 2);
+  EXPECT_EQ(blob.get().useCount(), 1);
+}
+
+TEST(ReactionTest, TestVersion) {
+  auto a = reaction::var(1);
+  auto b = reaction::var(2);
+  int count = 0;
+  auto ds = reaction::calc(
+      [&](int aa, int bb) {
+        ++count;
+        return aa + bb;
+      },
+      a, b);
+  auto node = ds.getSharedPtr();
+  auto version = a.getSharedPtr()->version();
+  a.value(5);
+  EXPECT_EQ(a.getSharedPtr()->version(), version + 1);
+  EXPECT_EQ(count, 2);
+
+  // 输入版本都没变时,重复的通知不会重算
+  auto& scheduler = reaction::Graph::instance().scheduler();
+  version = node->version();
+  scheduler.schedule(node.get());
+  scheduler.run();
+  EXPECT_EQ(count, 2);
+  EXPECT_EQ(node->version(), version);
+
+  auto lazy = reaction::lazyCalc(
+      [&](int dsds) {
+        ++count;
+        return dsds * 2;
+      },
+      ds);
+  EXPECT_EQ(lazy.get(), 14);
+  lazy.reset([&](int dsds) { return dsds * 3; }, ds);  // 换了函数,即使输入没变也要重算
+  EXPECT_EQ(lazy.get(), 21);
+}
+
+TEST(ReactionTest, TestResetUnsubscribe) {
+  auto a = reaction::var(1);
+  auto b = reaction::var(2);
+  int count = 0;
+  auto ds = reaction::calc(
+      [&](int aa, int bb) {
+        ++count;
+        return aa + bb;
+      },
+      a, b);
+  ds.reset([&](int aa) { return aa * 10; }, a);
+  EXPECT_EQ(b.getSharedPtr()->observerCount(), 0);  // 不再读取b
+
+  count = 0;
+  b.value(3);
+  EXPECT_EQ(count, 0);
+  EXPECT_EQ(ds.get(), 10);
+
+  for (int i = 0; i < 1000; ++i) {
+    if (i % 2) {
+      ds.reset([](int aa, int bb) { return aa - bb; }, a, b);
+    } else {
+      ds.reset([&]() { return a() * 2; });  // 在()形式和参数形式之间来回切换
+    }
+  }
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 1);
+  EXPECT_EQ(b.getSharedPtr()->observerCount(), 1);
+  a.value(4);
+  EXPECT_EQ(ds.get(), 1);
+}
+
+TEST(ReactionTest, TestPruneObservers) {
+  auto a = reaction::var(1);
+  auto square = [](int aa) { return aa * aa; };
+  std::vector<decltype(reaction::calc(square, a))> nodes;
+  for (int i = 0; i < 100; ++i) {
+    nodes.push_back(reaction::calc(square, a));
+  }
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 100);
+
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    nodes.erase(nodes.begin() + i);  // 不按创建顺序销毁,边会在列表中间被删掉
+  }
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), nodes.size());
+
+  auto sum = reaction::calc([&]() {
+    int total = 0;
+    for (auto& node : nodes) {
+      total += node();
+    }
+    return total;
+  });
+  a.value(3);
+  EXPECT_EQ(sum.get(), 9 * 50);
+  EXPECT_EQ(nodes.front().getSharedPtr()->observerCount(), 1);
+
+  nodes.clear();
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 0);  // 只剩下活着的观察者
+  a.value(4);
+}
+
+TEST(ReactionTest, TestDestroyDuringWave) {
+  auto a = reaction::var(1);
+  auto twice = [](int aa) { return aa * 2; };
+  auto plusOne = [&]() { return a() + 1; };
+  std::vector<decltype(reaction::calc(twice, a))> nodes;
+  std::vector<decltype(reaction::calc(plusOne))> dyns;
+  auto act = reaction::action(
+      [&](int) {
+        nodes.clear();  // 和它们在同一层,可能已经排在本轮的队列里
+        dyns.clear();
+      },
+      a);
+  for (int i = 0; i < 16; ++i) {
+    nodes.push_back(reaction::calc(twice, a));
+    dyns.push_back(reaction::calc(plusOne));
+  }
+  auto sum = reaction::calc([](int aa) { return aa * 3; }, a);
+
+  a.value(2);
+  EXPECT_TRUE(nodes.empty());
+  EXPECT_EQ(a.getSharedPtr()->observerCount(), 2);
+  a.value(3);
+  EXPECT_EQ(sum.get(), 9);
+}
+
+TEST(ReactionTest, TestRandomTopology) {
+  struct Pick {
+    bool isVar;
+    int index;
+    int seq;  // 读的是哪一代节点,槽位换了新节点就不再读
+  };
+  constexpr int kVars = 6;
+  constexpr int kSlots = 10;
+
+  for (unsigned seed = 1; seed <= 20; ++seed) {
+    std::mt19937 rng(seed);
+    auto random = [&](int n) { return static_cast<int>(rng() % static_cast<unsigned>(n)); };
+
+    std::function<int(const Pick&)> read;
+    auto makeFun = [&read](std::vector<Pick> picks) {
+      return [&read, picks]() {
+        int sum = 0;
+        for (const auto& pick : picks) {
+          if (sum > 6) {
+            break;  // 走到的分支随值变化,依赖集合也跟着变
+          }
+          sum += read(pick);
+        }
+        return sum;
+      };
+    };
+    auto add = [](int aa, int bb) { return aa + bb; };
+
+    std::vector<int> values(kVars);
+    std::vector<std::optional<decltype(reaction::var(0))>> vars;
+    for (int i = 0; i < kVars; ++i) {
+      vars.emplace_back(reaction::var(0));
+    }
+    std::vector<std::optional<decltype(reaction::calc(makeFun({})))>> dyns(kSlots);
+    std::vector<std::vector<Pick>> picksOf(kSlots);
+    std::vector<int> seqOf(kSlots, -1);
+    std::vector<std::optional<decltype(reaction::calc(add, *vars[0], *vars[0]))>> statics(kSlots);
+    std::vector<std::pair<int, int>> argsOf(kSlots);
+    int seq = 0;
+
+    read = [&](const Pick& pick) {
+      if (pick.isVar) {
+        return (*vars[pick.index])();
+      }
+      return dyns[pick.index] && seqOf[pick.index] == pick.seq ? (*dyns[pick.index])() : 0;
+    };
+    std::function<int(int)> expect = [&](int slot) {
+      int sum = 0;
+      for (const auto& pick : picksOf[slot]) {
+        if (sum > 6) {
+          break;
+        }
+        if (pick.isVar) {
+          sum += values[pick.index];
+        } else if (dyns[pick.index] && seqOf[pick.index] == pick.seq) {
+          sum += expect(pick.index);
+        }
+      }
+      return sum;
+    };
+    // 只读比自己早的节点,保证无环
+    auto randomPicks = [&](int before) {
+      std::vector<Pick> picks;
+      for (int n = 1 + random(3); n > 0; --n) {
+        int slot = random(kSlots);
+        if (random(2) && dyns[slot] && seqOf[slot] < before) {
+          picks.push_back({false, slot, seqOf[slot]});
+        } else {
+          picks.push_back({true, random(kVars), 0});
+        }
+      }
+      return picks;
+    };
+    // reset和销毁都不通知下游,读这个槽位的节点逐层重新计算一次
+    std::function<void(int)> refreshReaders = [&](int slot) {
+      for (int i = 0; i < kSlots; ++i) {
+        bool reads = std::any_of(picksOf[i].begin(), picksOf[i].end(),
+                                 [&](const Pick& pick) {
+                                   return !pick.isVar && pick.index == slot && pick.seq == seqOf[slot];
+                                 });
+        if (dyns[i] && reads) {
+          dyns[i]->reset(makeFun(picksOf[i]));
+          refreshReaders(i);
+        }
+      }
+    };
+
+    for (int step = 0; step < 300; ++step) {
+      int slot = random(kSlots);
+      switch (random(8)) {
+        case 0:
+        case 1: {
+          int i = random(kVars);
+          values[i] = random(4);
+          vars[i]->value(values[i]);
+          break;
+        }
+        case 2:
+          reaction::batch([&] {
+            for (int n = 0; n < 3; ++n) {
+              int i = random(kVars);
+              values[i] = random(4);
+              vars[i]->value(values[i]);
+            }
+          });
+          break;
+        case 3: {
+          dyns[slot].reset();
+          refreshReaders(slot);
+          picksOf[slot] = randomPicks(seq);
+          seqOf[slot] = seq++;
+          auto fun = makeFun(picksOf[slot]);
+          dyns[slot].emplace(random(3) ? reaction::calc(fun) : reaction::lazyCalc(fun));
+          if (random(2)) {
+            dyns[slot]->trigger(reaction::ChangeTrig{});
+          }
+          break;
+        }
+        case 4:
+          dyns[slot].reset();
+          refreshReaders(slot);
+          break;
+        case 5:
+          if (dyns[slot]) {
+            picksOf[slot] = randomPicks(seqOf[slot]);
+            dyns[slot]->reset(makeFun(picksOf[slot]));
+            refreshReaders(slot);
+          }
+          break;
+        case 6: {
+          argsOf[slot] = {random(kVars), random(kVars)};
+          auto& [l, r] = argsOf[slot];
+          statics[slot].reset();
+          statics[slot].emplace(random(2) ? reaction::calc(add, *vars[l], *vars[r])
+                                          : reaction::lazyCalc(add, *vars[l], *vars[r]));
+          break;
+        }
+        default:
+          statics[slot].reset();
+          break;
+      }
+      for (int i = 0; i < kSlots; ++i) {
+        if (dyns[i]) {
+          ASSERT_EQ(dyns[i]->get(), expect(i)) << "seed " << seed << " step " << step;
+        }
+        if (statics[i]) {
+          ASSERT_EQ(statics[i]->get(), values[argsOf[i].first] + values[argsOf[i].second]);
+        }
+      }
+    }
+
+    // 以随机顺序拆掉整张图
+    std::vector<std::function<void()>> teardown;
+    for (int i = 0; i < kSlots; ++i) {
+      teardown.push_back([&, i] { dyns[i].reset(); });
+      teardown.push_back([&, i] { statics[i].reset(); });
+    }
+    for (int i = 0; i < kVars; ++i) {
+      teardown.push_back([&, i] { vars[i].reset(); });
+    }
+    std::shuffle(teardown.begin(), teardown.end(), rng);
+    for (auto& step : teardown) {
+      step();
+    }
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();